@@ -0,0 +1,116 @@
+/*
+ * aggregate.c - interval aggregation of the sensor data
+ *
+ * This software is copyright 2008 by Frank Sautter
+ * (eltakoms~at~sautter~dot~com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ */
+
+#include <string.h>
+#include "aggregate.h"
+
+/* a window never crosses a multiple of interval, so after a change the first one is shorter */
+static void agg_reset (struct aggregator *ag, time_t start) {
+  memset (&ag->cur, 0, sizeof (ag->cur));
+  ag->cur.start = start;
+  ag->cur.interval = ag->interval - start % ag->interval;
+}
+
+void agg_init (struct aggregator *ag, int interval, time_t now) {
+  ag->interval = interval;
+  agg_reset (ag, now - now % interval);
+}
+
+/* change the interval; the current window is closed as it was planned */
+void agg_interval (struct aggregator *ag, int interval) {
+  ag->interval = interval;
+}
+
+/* close all windows that ended before now; returns the number emitted */
+int agg_tick (struct aggregator *ag, time_t now, agg_emit_fn fn, void *arg) {
+  time_t next;
+  int n = 0;
+
+  if (now < ag->cur.start - ag->interval) {                      // clock stepped back
+    agg_reset (ag, now - now % ag->interval);
+    return 0;
+  }
+  while (now >= agg_deadline (ag)) {
+    fn (&ag->cur, arg);
+    n++;
+    next = agg_deadline (ag);
+    if (now - next > (time_t)AGG_MAXGAPS * ag->interval)
+      next = now - now % ag->interval;
+    agg_reset (ag, next);
+  }
+  return n;
+}
+
+int agg_add (struct aggregator *ag, const struct ms_sample *smp, time_t t, agg_emit_fn fn, void *arg) {
+  struct agg_channel *c;
+  double delta;
+  int n, ch, x;
+
+  n = agg_tick (ag, t, fn, arg);
+  ag->cur.count++;
+  for (ch = 0; ch < CH_COUNT; ch++) {
+    c = &ag->cur.ch[ch];
+    x = ms_channel (smp, ch);
+    if (ag->cur.count == 1) {
+      c->min = c->max = x;
+    } else {
+      c->min = (x < c->min) ? x : c->min;
+      c->max = (x > c->max) ? x : c->max;
+    }
+    delta = x - c->mean;
+    c->mean += delta / ag->cur.count;
+    c->m2 += delta * (x - c->mean);
+  }
+  return n;
+}
+
+/*
+ * add the samples of src to dst, which cover the same window (e.g. the
+ * halves of one that was split up between threads)
+ */
+void agg_merge (struct agg_record *dst, const struct agg_record *src) {
+  struct agg_channel *d;
+  const struct agg_channel *s;
+  double delta, n;
+  int ch;
+
+  if (src->count == 0)
+    return;
+  if (dst->count == 0) {
+    memcpy (dst->ch, src->ch, sizeof (dst->ch));
+    dst->count = src->count;
+    return;
+  }
+  n = (double)dst->count + src->count;
+  for (ch = 0; ch < CH_COUNT; ch++) {
+    d = &dst->ch[ch];
+    s = &src->ch[ch];
+    delta = s->mean - d->mean;
+    d->mean += delta * src->count / n;
+    d->m2 += s->m2 + delta * delta * dst->count * src->count / n;
+    d->min = (s->min < d->min) ? s->min : d->min;
+    d->max = (s->max > d->max) ? s->max : d->max;
+  }
+  dst->count += src->count;
+}
+
+/* population variance of a channel */
+double agg_variance (const struct agg_record *rec, int ch) {
+  return (rec->count > 0) ? rec->ch[ch].m2 / rec->count : 0.0;
+}
+
+/* mean rounded half away from zero */
+int agg_mean (const struct agg_record *rec, int ch) {
+  double m = rec->ch[ch].mean;
+
+  return (int)((m < 0) ? m - .5 : m + .5);
+}
@@ -0,0 +1,66 @@
+/*
+ * aggregate.h - interval aggregation of the sensor data
+ *
+ * This software is copyright 2008 by Frank Sautter
+ * (eltakoms~at~sautter~dot~com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ */
+
+#ifndef AGGREGATE_H
+#define AGGREGATE_H
+
+#include <time.h>
+#include "datagram.h"
+
+/* running statistics of one channel (Welford) */
+struct agg_channel {
+  double mean;
+  double m2;                           /* sum of squared deviations */
+  int min;
+  int max;
+};
+
+/* one interval [start, start + interval); count 0 marks a gap */
+struct agg_record {
+  time_t start;
+  int interval;
+  int count;
+  struct agg_channel ch[CH_COUNT];
+};
+
+typedef void (*agg_emit_fn) (const struct agg_record *rec, void *arg);
+
+/*
+ * Windows are aligned to multiples of interval and closed by the clock
+ * (agg_tick()), not by the next sample, so every interval produces
+ * exactly one record. After an outage of more than AGG_MAXGAPS intervals
+ * (or a clock step) the aggregator skips ahead instead of emitting a
+ * gap record for each of them. A sample up to one interval older than
+ * the current window is one that was queued before the window closed
+ * and counts in the current window; only an older one means the clock
+ * stepped back and starts over.
+ */
+#define AGG_MAXGAPS 1440
+
+struct aggregator {
+  int interval;
+  struct agg_record cur;
+};
+
+void agg_init (struct aggregator *ag, int interval, time_t now);
+void agg_interval (struct aggregator *ag, int interval);
+int agg_tick (struct aggregator *ag, time_t now, agg_emit_fn fn, void *arg);
+int agg_add (struct aggregator *ag, const struct ms_sample *smp, time_t t, agg_emit_fn fn, void *arg);
+void agg_merge (struct agg_record *dst, const struct agg_record *src);
+
+double agg_variance (const struct agg_record *rec, int ch);
+int agg_mean (const struct agg_record *rec, int ch);
+
+/* end of the current window, i.e. when agg_tick() has work next */
+#define agg_deadline(_AG_) ((_AG_)->cur.start + (_AG_)->cur.interval)
+
+#endif /* AGGREGATE_H */
@@ -0,0 +1,224 @@
+/*
+ * binlog.c - binary append-only log of the logging intervals
+ *
+ * This software is copyright 2008 by Frank Sautter
+ * (eltakoms~at~sautter~dot~com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "binlog.h"
+
+#define RECOFF(_N_) ((off_t)sizeof (struct binlog_hdr) + (off_t)(_N_) * sizeof (struct binlog_rec))
+
+/* write the index from scratch, e.g. after a crash between the two files */
+static int binlog_reindex (struct binlog *bl) {
+  struct binlog_rec rec;
+  struct binlog_idx ent;
+  uint32_t i;
+
+  if (ftruncate (bl->idxfd, 0) == -1 || lseek (bl->idxfd, 0, SEEK_SET) == -1)
+    return -1;
+  for (i = 0; i < bl->count; i += bl->step) {
+    if (pread (bl->fd, &rec, sizeof (rec), RECOFF(i)) != sizeof (rec))
+      return -1;
+    ent.time = rec.time;
+    ent.rec = i;
+    if (write (bl->idxfd, &ent, sizeof (ent)) != sizeof (ent))
+      return -1;
+  }
+  return 0;
+}
+
+int binlog_open (struct binlog *bl, const char *path) {
+  struct binlog_hdr hdr;
+  struct stat st;
+  char idxf[200];
+
+  bl->fd = bl->idxfd = -1;
+  if ((bl->fd = open (path, O_RDWR | O_CREAT, 0644)) == -1 || fstat (bl->fd, &st) == -1)
+    goto fail;
+
+  if (st.st_size < (off_t)sizeof (hdr)) {                       // new file
+    memset (&hdr, 0, sizeof (hdr));
+    hdr.magic = BINLOG_MAGIC;
+    hdr.version = BINLOG_VERSION;
+    hdr.recsize = sizeof (struct binlog_rec);
+    hdr.step = BINLOG_STEP;
+    if (ftruncate (bl->fd, 0) == -1 || pwrite (bl->fd, &hdr, sizeof (hdr), 0) != sizeof (hdr))
+      goto fail;
+    st.st_size = sizeof (hdr);
+  } else if (pread (bl->fd, &hdr, sizeof (hdr), 0) != sizeof (hdr) ||
+             hdr.magic != BINLOG_MAGIC || hdr.recsize != sizeof (struct binlog_rec) || hdr.step == 0)
+    goto fail;
+  bl->step = hdr.step;
+  bl->count = (st.st_size - sizeof (hdr)) / sizeof (struct binlog_rec);
+  if (ftruncate (bl->fd, RECOFF(bl->count)) == -1)              // drop a partial record
+    goto fail;
+  lseek (bl->fd, 0, SEEK_END);
+
+  snprintf (idxf, sizeof (idxf), "%s.idx", path);
+  if ((bl->idxfd = open (idxf, O_RDWR | O_CREAT, 0644)) == -1 || fstat (bl->idxfd, &st) == -1)
+    goto fail;
+  if (st.st_size != (off_t)((bl->count + bl->step - 1) / bl->step * sizeof (struct binlog_idx)) &&
+      binlog_reindex (bl) == -1)
+    goto fail;
+  lseek (bl->idxfd, 0, SEEK_END);
+  return 0;
+
+fail:                                                           // opened again at every reload
+  binlog_close (bl);
+  return -1;
+}
+
+/* the values that go into the logs for an interval */
+void binlog_fill (struct binlog_rec *r, const struct agg_record *rec) {
+  memset (r, 0, sizeof (*r));
+  r->time = rec->start + rec->interval;
+  r->count = (rec->count > 0xffff) ? 0xffff : rec->count;
+  if (rec->count) {
+    r->temp = agg_mean (rec, CH_TEMP);
+    r->wind = rec->ch[CH_WIND].max;
+    r->dawn = agg_mean (rec, CH_DAWN);
+    r->sunS = agg_mean (rec, CH_SUNS);
+    r->sunW = agg_mean (rec, CH_SUNW);
+    r->sunE = agg_mean (rec, CH_SUNE);
+    r->flags = (rec->ch[CH_RAIN].max ? MS_RAIN : 0) | (rec->ch[CH_OBSC].max ? MS_OBSC : 0);
+  }
+}
+
+/* "t+07.6s01w63e00od999v01.2r" as in the text log, or "gap" */
+int binlog_values (char *out, int size, const struct binlog_rec *r) {
+  if (r->count == 0)
+    return snprintf (out, size, "gap");
+  return snprintf (out, size, "t%+05.1fs%2.2dw%2.2de%2.2d%cd%3.3dv%04.1f%c",
+                   (float)r->temp/10, r->sunS, r->sunW, r->sunE,
+                   (r->flags & MS_OBSC) ? 'O' : 'o', r->dawn,
+                   (float)r->wind/10, (r->flags & MS_RAIN) ? 'R' : 'r');
+}
+
+/*
+ * "<time>:<temp>:<wind>:<rain>:<sunE>:<sunS>:<sunW>:<dawn>:<obsc>" for
+ * rrdtool update, in the DS order of tools/eltako2rrd.pl; a gap is all "U"
+ */
+int binlog_rrd (char *out, int size, const struct binlog_rec *r) {
+  if (r->count == 0)
+    return snprintf (out, size, "%lu:U:U:U:U:U:U:U:U", (unsigned long)r->time);
+  return snprintf (out, size, "%lu:%+05.1f:%04.1f:%d:%2.2d:%2.2d:%2.2d:%3.3d:%d",
+                   (unsigned long)r->time, (float)r->temp/10, (float)r->wind/10,
+                   (r->flags & MS_RAIN) ? 1 : 0, r->sunE, r->sunS, r->sunW, r->dawn,
+                   (r->flags & MS_OBSC) ? 1 : 0);
+}
+
+void binlog_append (struct binlog *bl, const struct binlog_rec *rec) {
+  struct binlog_rec r = *rec;
+  struct binlog_idx ent;
+
+  if (bl->fd == -1)
+    return;
+
+  if (bl->count % bl->step == 0) {
+    ent.time = r.time;
+    ent.rec = bl->count;
+    if (write (bl->idxfd, &ent, sizeof (ent)) != sizeof (ent))
+      return;
+  }
+  if (write (bl->fd, &r, sizeof (r)) == sizeof (r))
+    bl->count++;
+}
+
+void binlog_close (struct binlog *bl) {
+  if (bl->fd != -1)
+    close (bl->fd);
+  if (bl->idxfd != -1)
+    close (bl->idxfd);
+  bl->fd = bl->idxfd = -1;
+}
+
+static const void *binlog_mapfile (const char *path, size_t *size) {
+  struct stat st;
+  void *p;
+  int fd;
+
+  *size = 0;
+  if ((fd = open (path, O_RDONLY)) == -1)
+    return NULL;
+  if (fstat (fd, &st) == -1 || st.st_size == 0) {
+    close (fd);
+    return NULL;
+  }
+  p = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+  if (p == MAP_FAILED)
+    return NULL;
+  *size = st.st_size;
+  return p;
+}
+
+/* map a log (and its index, if there is one) read-only */
+int binlog_map (struct binlog_map *m, const char *path) {
+  char idxf[200];
+
+  memset (m, 0, sizeof (*m));
+  if ((m->hdr = binlog_mapfile (path, &m->size)) == NULL)
+    return -1;
+  if (m->size < sizeof (struct binlog_hdr) || m->hdr->magic != BINLOG_MAGIC ||
+      m->hdr->recsize != sizeof (struct binlog_rec)) {
+    binlog_unmap (m);
+    return -1;
+  }
+  m->rec = (const struct binlog_rec *)(m->hdr + 1);
+  m->count = (m->size - sizeof (struct binlog_hdr)) / sizeof (struct binlog_rec);
+
+  snprintf (idxf, sizeof (idxf), "%s.idx", path);
+  if ((m->idx = binlog_mapfile (idxf, &m->idxsize)) != NULL)
+    m->nidx = m->idxsize / sizeof (struct binlog_idx);
+  if (m->nidx > (m->count + m->hdr->step - 1) / m->hdr->step)
+    m->nidx = (m->count + m->hdr->step - 1) / m->hdr->step;     // index ahead of the log
+  return 0;
+}
+
+/* index of the first record with time >= t (count if there is none) */
+uint32_t binlog_find (const struct binlog_map *m, time_t t) {
+  uint32_t lo = 0, hi = m->count, mid;
+  uint32_t a = 0, b = m->nidx;
+
+  if (m->nidx) {                                                // narrow down to one block
+    while (a < b) {
+      mid = a + (b - a) / 2;
+      if (m->idx[mid].time < t)
+        a = mid + 1;
+      else
+        b = mid;
+    }
+    lo = (a > 0) ? m->idx[a - 1].rec : 0;
+    if (a < m->nidx)
+      hi = m->idx[a].rec;
+  }
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (m->rec[mid].time < t)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+void binlog_unmap (struct binlog_map *m) {
+  if (m->hdr)
+    munmap ((void *)m->hdr, m->size);
+  if (m->idx)
+    munmap ((void *)m->idx, m->idxsize);
+  memset (m, 0, sizeof (*m));
+}
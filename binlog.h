@@ -0,0 +1,84 @@
+/*
+ * binlog.h - binary append-only log of the logging intervals
+ *
+ * This software is copyright 2008 by Frank Sautter
+ * (eltakoms~at~sautter~dot~com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ */
+
+#ifndef BINLOG_H
+#define BINLOG_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+#include "aggregate.h"
+
+/*
+ * <file> starts with a struct binlog_hdr followed by fixed size records
+ * in time order (native byte order). <file>.idx holds the time of every
+ * hdr.step'th record, so readers can mmap both files and binary search
+ * the index instead of scanning the whole log.
+ */
+#define BINLOG_MAGIC   0x4c534d45      /* "EMSL" */
+#define BINLOG_VERSION 1
+#define BINLOG_STEP    256             /* records per index entry */
+
+struct binlog_hdr {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t recsize;                    /* sizeof (struct binlog_rec) */
+  uint32_t step;                       /* records per index entry */
+  uint32_t reserved;
+};
+
+struct binlog_rec {
+  uint32_t time;                       /* end of the interval */
+  uint16_t count;                      /* samples, 0 = gap */
+  int16_t temp;                        /* average, tenths */
+  uint16_t wind;                       /* maximum, tenths */
+  uint16_t dawn;                       /* average */
+  uint8_t sunS, sunW, sunE;            /* averages */
+  uint8_t flags;                       /* MS_RAIN, MS_OBSC seen */
+};
+
+struct binlog_idx {
+  uint32_t time;
+  uint32_t rec;
+};
+
+/* writer */
+struct binlog {
+  int fd;
+  int idxfd;
+  uint32_t step;
+  uint32_t count;                      /* records in the file */
+};
+
+void binlog_fill (struct binlog_rec *r, const struct agg_record *rec);
+int binlog_values (char *out, int size, const struct binlog_rec *r);
+int binlog_rrd (char *out, int size, const struct binlog_rec *r);
+
+int binlog_open (struct binlog *bl, const char *path);
+void binlog_append (struct binlog *bl, const struct binlog_rec *rec);
+void binlog_close (struct binlog *bl);
+
+/* reader */
+struct binlog_map {
+  const struct binlog_hdr *hdr;
+  const struct binlog_rec *rec;
+  uint32_t count;
+  const struct binlog_idx *idx;
+  uint32_t nidx;
+  size_t size, idxsize;
+};
+
+int binlog_map (struct binlog_map *m, const char *path);
+uint32_t binlog_find (const struct binlog_map *m, time_t t);
+void binlog_unmap (struct binlog_map *m);
+
+#endif /* BINLOG_H */
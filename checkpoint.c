@@ -0,0 +1,102 @@
+/*
+ * checkpoint.c - aggregation state that survives a restart
+ *
+ * This software is copyright 2008 by Frank Sautter
+ * (eltakoms~at~sautter~dot~com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ */
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include "checkpoint.h"
+#include "timestamp.h"
+
+/* map path, keeping what an earlier daemon left there if it is ours */
+int ckpt_open (struct ckpt *ck, const char *path) {
+  struct ms_ckpt *m;
+  int fd;
+
+  ck->map = NULL;
+  if ((fd = open (path, O_RDWR | O_CREAT, 0644)) == -1)
+    return -1;
+  if (ftruncate (fd, sizeof (*m)) == -1) {
+    close (fd);
+    return -1;
+  }
+  m = mmap (NULL, sizeof (*m), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close (fd);
+  if (m == MAP_FAILED)
+    return -1;
+  if (m->magic != CKPT_MAGIC || m->version != CKPT_VERSION || m->size != sizeof (*m)) {
+    memset (m, 0, sizeof (*m));
+    m->magic = CKPT_MAGIC;
+    m->version = CKPT_VERSION;
+    m->size = sizeof (*m);
+  }
+  ck->map = m;
+  return 0;
+}
+
+/*
+ * A saved window is taken if it has the same length and was open within
+ * a period; the steady clock of the daemon before may have been up to
+ * TS_MAXSKEW ahead.
+ */
+static int ckpt_window (struct aggregator *ag, const struct agg_record *rec, int period,
+                        time_t saved, time_t now) {
+  if (period != ag->interval || rec->interval <= 0 || saved - now > TS_MAXSKEW || now - saved > period ||
+      saved < rec->start || saved >= rec->start + rec->interval)
+    return 0;
+  ag->cur = *rec;
+  return 1;
+}
+
+/*
+ * Carry on with the windows of the last checkpoint; windows that ended
+ * meanwhile are closed by the next agg_tick () as usual. Returns the
+ * number of windows restored.
+ */
+int ckpt_restore (struct ckpt *ck, struct aggregator *ag, struct rollup *ru, time_t now) {
+  const struct ckpt_slot *s;
+  int i, n = 0;
+
+  if (ck->map == NULL || ck->map->gen == 0)
+    return 0;
+  s = &ck->map->slot[ck->map->gen & 1];
+  n += ckpt_window (ag, &s->agg, s->interval, s->saved, now);
+  for (i = 0; i < ru->n && i < s->nrollup; i++)
+    n += ckpt_window (&ru->win[i].ag, &s->rollup[i], s->period[i], s->saved, now);
+  return n;
+}
+
+void ckpt_save (struct ckpt *ck, const struct aggregator *ag, const struct rollup *ru, time_t now) {
+  struct ckpt_slot *s;
+  int i;
+
+  if (ck->map == NULL)
+    return;
+  s = &ck->map->slot[(ck->map->gen + 1) & 1];
+  s->saved = now;
+  s->interval = ag->interval;
+  s->agg = ag->cur;
+  for (i = 0; i < ru->n; i++) {
+    s->period[i] = ru->win[i].ag.interval;
+    s->rollup[i] = ru->win[i].ag.cur;
+  }
+  s->nrollup = ru->n;
+  __sync_synchronize ();
+  ck->map->gen++;
+}
+
+void ckpt_close (struct ckpt *ck) {
+  if (ck->map)
+    munmap (ck->map, sizeof (*ck->map));
+  ck->map = NULL;
+}
@@ -0,0 +1,60 @@
+/*
+ * checkpoint.h - aggregation state that survives a restart
+ *
+ * This software is copyright 2008 by Frank Sautter
+ * (eltakoms~at~sautter~dot~com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ */
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdint.h>
+#include <time.h>
+#include "aggregate.h"
+#include "rollup.h"
+
+/*
+ * The open logging window and rollup windows of a sensor, mapped from
+ * <shmdir>/<program>-<tty>.state and updated in place after every
+ * datagram. There are two slots: the writer fills the one gen does not
+ * point to and then moves gen on, so a daemon killed halfway still
+ * leaves the other slot intact. A restarted daemon carries on with
+ * windows that are at most one period old, so the first interval after
+ * a restart is not built from a partial window.
+ */
+#define CKPT_MAGIC   0x43534d45        /* "EMSC" */
+#define CKPT_VERSION 1
+
+struct ckpt_slot {
+  int64_t saved;                       /* steady clock of the update */
+  int32_t interval;
+  int32_t nrollup;
+  struct agg_record agg;
+  int32_t period[ROLLUP_MAX];
+  struct agg_record rollup[ROLLUP_MAX];
+};
+
+struct ms_ckpt {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t size;                       /* sizeof (struct ms_ckpt) */
+  volatile uint32_t gen;               /* slot[gen & 1] is valid */
+  uint32_t reserved;
+  struct ckpt_slot slot[2];
+};
+
+struct ckpt {
+  struct ms_ckpt *map;                 /* NULL = no checkpoints */
+};
+
+int ckpt_open (struct ckpt *ck, const char *path);
+int ckpt_restore (struct ckpt *ck, struct aggregator *ag, struct rollup *ru, time_t now);
+void ckpt_save (struct ckpt *ck, const struct aggregator *ag, const struct rollup *ru, time_t now);
+void ckpt_close (struct ckpt *ck);
+
+#endif /* CHECKPOINT_H */
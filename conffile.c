@@ -0,0 +1,278 @@
+/*
+ * conffile.c - run time configuration from the command line and a
+ *              config file (-C)
+ *
+ * This software is copyright 2008 by Frank Sautter
+ * (eltakoms~at~sautter~dot~com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <termios.h>
+#include "config.h"
+#include "status.h"
+#include "conffile.h"
+
+#define CONF_LOGDIR   1                /* options without a letter */
+#define CONF_SHMDIR   2
+#define CONF_LOCKDIR  3
+#define CONF_STATUS   4
+#define CONF_RTSCTS   5
+
+static const struct {
+  const char *key;
+  int opt;
+} conf_keys[] = {
+  { "device",    'f' },
+  { "logfile",   'l' },
+  { "interval",  'i' },
+  { "flush",     'F' },
+  { "flushtime", 'T' },
+  { "binlog",    'b' },
+  { "rollup",    'R' },
+  { "rrdcached", 'Q' },
+  { "sink",      'o' },
+  { "rule",      'A' },
+  { "capture",   'c' },
+  { "samplelog", 'S' },
+  { "decimate",  'D' },
+  { "baud",      'B' },
+  { "stale",     'W' },
+  { "deadband",  'd' },
+  { "heartbeat", 'e' },
+  { "rxmode",    'X' },
+  { "lowlatency", 'L' },
+  { "rtscts",    CONF_RTSCTS },
+  { "syslog",    's' },
+  { "syslogd",   'Y' },
+  { "rfc5424",   'Z' },
+  { "prometheus", 'P' },
+  { "status",    CONF_STATUS },
+  { "history",   'H' },
+  { "logdir",    CONF_LOGDIR },
+  { "shmdir",    CONF_SHMDIR },
+  { "lockdir",   CONF_LOCKDIR },
+  { NULL,        0 }
+};
+
+static const struct {
+  int baud;
+  int speed;
+} bauds[] = {
+  { 1200, B1200 }, { 2400, B2400 }, { 4800, B4800 }, { 9600, B9600 },
+  { 19200, B19200 }, { 38400, B38400 }, { 57600, B57600 }, { 115200, B115200 },
+  { 0, 0 }
+};
+
+void conf_init (struct conf *cf) {
+  memset (cf, 0, sizeof (*cf));
+  strcpy (cf->logdir, DEFLOG);
+  strcpy (cf->shmdir, DEFSHM);
+  strcpy (cf->lockdir, LOCKPATH);
+  cf->interval = 60;
+  cf->flush_n = 1;
+  cf->decimate = 1;
+  cf->stale = 10;
+  cf->heartbeat = 60;
+  cf->baud = 19200;
+  cf->rtscts = 1;
+  cf->shmmode = STATUS_FILE;
+}
+
+/* termios speed of a baud rate, -1 if there is none */
+int conf_baud (int baud) {
+  int i;
+
+  for (i = 0; bauds[i].baud; i++)
+    if (bauds[i].baud == baud)
+      return bauds[i].speed;
+  return -1;
+}
+
+/* flags on the command line have no argument, in the file "yes" or "1" */
+static int conf_bool (const char *arg) {
+  return (arg == NULL || *arg == '\0' || strcmp (arg, "yes") == 0 || strcmp (arg, "1") == 0);
+}
+
+/* the first list option of a source replaces what an earlier source set */
+static void conf_list (struct conf *cf, int opt, int *n) {
+  unsigned int bit = 1u << (opt & 31);
+
+  if (!(cf->lists & bit))
+    *n = 0;
+  cf->lists |= bit;
+}
+
+static int conf_path (char *dst, const char *arg) {
+  if (strlen (arg) >= CONF_PATHLEN)
+    return -1;
+  strcpy (dst, arg);
+  return 0;
+}
+
+/* apply one option; returns -1 if arg is not valid for it */
+int conf_set (struct conf *cf, int opt, const char *arg) {
+  const char *s;
+
+  switch (opt) {
+    case 'f':
+      conf_list (cf, opt, &cf->ndevice);
+      if (cf->ndevice == CONF_MAXDEV)
+        return -1;
+      return conf_path (cf->device[cf->ndevice++], arg);
+    case 'l':
+      cf->use_syslog = 0;
+      return conf_path (cf->logfile, arg);
+    case 'i':
+      return ((cf->interval = atoi (arg)) < 10) ? -1 : 0;
+    case 'F':
+      return ((cf->flush_n = atoi (arg)) < 0) ? -1 : 0;
+    case 'T':
+      return ((cf->flush_t = atoi (arg)) < 0) ? -1 : 0;
+    case 'b':
+      return conf_path (cf->binlog, arg);
+    case 'c':
+      return conf_path (cf->capture, arg);
+    case 'S':
+      return conf_path (cf->samplelog, arg);
+    case 'D':
+      if (strcmp (arg, "change") == 0)
+        cf->decimate = 0;
+      else if ((cf->decimate = atoi (arg)) < 1)
+        return -1;
+      return 0;
+    case 'R':
+      conf_list (cf, opt, &cf->nrollup);
+      if ((s = strchr (arg, ':')) == NULL || cf->nrollup == ROLLUP_MAX ||
+          (cf->rollup_period[cf->nrollup] = atoi (arg)) <= 0)
+        return -1;
+      return conf_path (cf->rollup_rrd[cf->nrollup++], s + 1);
+    case 'Q':
+      return conf_path (cf->rrdcached, arg);
+    case 'o':
+      conf_list (cf, opt, &cf->nsink);
+      if (cf->nsink == SINK_MAX)
+        return -1;
+      return conf_path (cf->sink[cf->nsink++], arg);
+    case 'A':
+      conf_list (cf, opt, &cf->nrule);
+      if (cf->nrule == RULES_MAX || strlen (arg) >= sizeof (cf->rule[0]))
+        return -1;
+      strcpy (cf->rule[cf->nrule++], arg);
+      return 0;
+    case 'B':
+      cf->baud = atoi (arg);
+      return (conf_baud (cf->baud) == -1) ? -1 : 0;
+    case 'W':
+      return ((cf->stale = atoi (arg)) < 0) ? -1 : 0;
+    case 'd':
+      return conf_path (cf->deadband, arg);
+    case 'e':
+      return ((cf->heartbeat = atoi (arg)) < 0) ? -1 : 0;
+    case 'P':
+      return ((cf->prometheus = atoi (arg)) <= 0 || cf->prometheus > 65535) ? -1 : 0;
+    case 's':
+      cf->use_syslog = conf_bool (arg);
+      return 0;
+    case 'Y':
+      return conf_path (cf->syslogd, arg);
+    case 'Z':
+      cf->rfc5424 = conf_bool (arg);
+      return 0;
+    case 'X':
+      if (strcmp (arg, "byte") == 0)
+        cf->rxmode = CONF_RX_BYTE;
+      else if (strcmp (arg, "frame") == 0)
+        cf->rxmode = CONF_RX_FRAME;
+      else
+        return -1;
+      return 0;
+    case 'L':
+      cf->lowlatency = conf_bool (arg);
+      return 0;
+    case 'H':
+      cf->history = conf_bool (arg);
+      return 0;
+    case 'N':
+      cf->rtscts = 0;
+      return 0;
+    case CONF_RTSCTS:
+      cf->rtscts = conf_bool (arg);
+      return 0;
+    case 'm':
+      cf->shmmode = STATUS_MMAP;
+      return 0;
+    case 'M':
+      cf->shmmode = STATUS_MMAP_BIN;
+      return 0;
+    case CONF_STATUS:
+      if (strcmp (arg, "file") == 0)
+        cf->shmmode = STATUS_FILE;
+      else if (strcmp (arg, "mmap") == 0)
+        cf->shmmode = STATUS_MMAP;
+      else if (strcmp (arg, "bin") == 0)
+        cf->shmmode = STATUS_MMAP_BIN;
+      else
+        return -1;
+      return 0;
+    case CONF_LOGDIR:
+      return conf_path (cf->logdir, arg);
+    case CONF_SHMDIR:
+      return conf_path (cf->shmdir, arg);
+    case CONF_LOCKDIR:
+      return conf_path (cf->lockdir, arg);
+  }
+  return -1;
+}
+
+/*
+ * Read "<keyword> <value>" lines; empty lines and lines starting with
+ * '#' are ignored. On errors err describes the first bad line.
+ */
+int conf_load (struct conf *cf, const char *file, char *err, int errsize) {
+  char line[300];
+  char *key, *arg, *end;
+  FILE *fp;
+  int n = 0, i;
+
+  if ((fp = fopen (file, "r")) == NULL) {
+    snprintf (err, errsize, "cannot open %s", file);
+    return -1;
+  }
+  cf->lists = 0;
+  while (fgets (line, sizeof (line), fp)) {
+    n++;
+    for (key = line; isspace ((unsigned char)*key); key++)
+      ;
+    for (end = key + strlen (key); end > key && isspace ((unsigned char)end[-1]); end--)
+      ;
+    *end = '\0';
+    if (*key == '\0' || *key == '#')
+      continue;
+    for (arg = key; *arg && !isspace ((unsigned char)*arg); arg++)
+      ;
+    if (*arg)
+      *arg++ = '\0';
+    while (isspace ((unsigned char)*arg))
+      arg++;
+
+    for (i = 0; conf_keys[i].key; i++)
+      if (strcmp (conf_keys[i].key, key) == 0)
+        break;
+    if (conf_keys[i].key == NULL || conf_set (cf, conf_keys[i].opt, arg) == -1) {
+      snprintf (err, errsize, "%s:%d: invalid %s %s", file, n, conf_keys[i].key ? "value for" : "keyword", key);
+      fclose (fp);
+      return -1;
+    }
+  }
+  fclose (fp);
+  cf->lists = 0;
+  return 0;
+}
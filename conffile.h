@@ -0,0 +1,74 @@
+/*
+ * conffile.h - run time configuration from the command line and a
+ *              config file (-C)
+ *
+ * This software is copyright 2008 by Frank Sautter
+ * (eltakoms~at~sautter~dot~com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ */
+
+#ifndef CONFFILE_H
+#define CONFFILE_H
+
+#include "rollup.h"
+#include "sink.h"
+#include "rules.h"
+
+#define CONF_MAXDEV  16
+#define CONF_RX_BYTE  0                /* wake up for every byte */
+#define CONF_RX_FRAME 1                /* wake up for a datagram (VMIN) */
+#define CONF_PATHLEN 160
+
+/*
+ * Every setting has a command line option; the config file holds
+ * "<keyword> <value>" lines with the same meaning (see conf_keys in
+ * conffile.c). Options on the command line override the file, a list
+ * option given there replaces the whole list of the file.
+ */
+struct conf {
+  char device[CONF_MAXDEV][CONF_PATHLEN];
+  int ndevice;
+  char logfile[CONF_PATHLEN];          /* "" = <logdir>/<program>-<tty>.log */
+  char logdir[CONF_PATHLEN];
+  char shmdir[CONF_PATHLEN];
+  char lockdir[CONF_PATHLEN];
+  char binlog[CONF_PATHLEN];
+  char capture[CONF_PATHLEN];
+  char samplelog[CONF_PATHLEN];        /* "" = no log of every datagram */
+  int decimate;                        /* log every nth datagram, 0 = changes only */
+  int interval;
+  int flush_n, flush_t;
+  int use_syslog;
+  char syslogd[CONF_PATHLEN];          /* messages of the writer go there, "" = /dev/log */
+  int rfc5424;                         /* in the format of RFC 5424 instead of RFC 3164 */
+  int shmmode;                         /* STATUS_* */
+  int history;                         /* ring of recent datagrams in <shmfile>.hist */
+  int baud;
+  int rxmode;                          /* CONF_RX_* */
+  int lowlatency;                      /* ASYNC_LOW_LATENCY on the uart */
+  int rtscts;                          /* hardware flow control */
+  int stale;                           /* s without datagrams until the status is stale, 0 = never */
+  char deadband[CONF_PATHLEN];         /* publish only changes beyond these, "" = every datagram */
+  int heartbeat;                       /* s, but at least this often */
+  int prometheus;                      /* port of the metrics endpoint, 0 = none */
+  int rollup_period[ROLLUP_MAX];
+  char rollup_rrd[ROLLUP_MAX][CONF_PATHLEN];
+  int nrollup;
+  char rrdcached[CONF_PATHLEN];        /* rollups go to this rrdcached, "" = rrdtool */
+  char sink[SINK_MAX][CONF_PATHLEN];
+  int nsink;
+  char rule[RULES_MAX][200];
+  int nrule;
+  unsigned int lists;                  /* lists already set by this source */
+};
+
+void conf_init (struct conf *cf);
+int conf_set (struct conf *cf, int opt, const char *arg);
+int conf_load (struct conf *cf, const char *file, char *err, int errsize);
+int conf_baud (int baud);
+
+#endif /* CONFFILE_H */
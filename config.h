@@ -12,4 +12,19 @@
 /* #define LOCKPATH "/usr/spool/uucp" */
 /* #define LOCKPATH "/var/spool/uucp" */
 #define LOCKPATH "/var/lock"
+
+/*
+ * defaults for device, logfiles (-l) and status files; they can also be
+ * set in the config file (-C)
+ */
+
+#define DEFTTY "/dev/ttyS1"
+#define DEFLOG "/usb/log"
+#define DEFSHM "/dev/shm"
  
+
+/*
+ * rrdtool binary used for the rollup windows (-R)
+ */
+
+#define RRDTOOL "/usr/bin/rrdtool"
@@ -0,0 +1,263 @@
+/*
+ * datagram.c - validation of Eltako Multisensor datagrams
+ *
+ * This software is copyright 2008 by Frank Sautter
+ * (eltakoms~at~sautter~dot~com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ */
+
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include "datagram.h"
+
+/*
+ * A frame layout is a list of fields in order of their offset, as
+ *   F (<kind>, <offset>, <picture>, <error bit>, <target>)
+ * with the kinds
+ *   LIT   the picture is fixed text
+ *   SIGN  '+' or '-', the sign of the NUM that follows
+ *   NUM   '9' in the picture is a digit, anything else fixed text; the
+ *         digits make up the value of smp-><target>
+ *   FLAG  'J' (sets the bit <target> in smp->flags) or 'N'
+ *   CSUM  decimal sum of all bytes before <offset>
+ * Positions no field covers (the ETX) are not checked, the length check
+ * covers them. MS_LAYOUT () below turns a list into a validator and a
+ * decoder, so another sensor variant is another list.
+ */
+#define ELTAKO_MS(F) \
+  F (LIT,   0, "W",              MS_ERR_SYNC,  -) \
+  F (SIGN,  1, "+",              MS_ERR_SIGN,  -) \
+  F (NUM,   2, "99.9",           MS_ERR_TEMP,  temp) \
+  F (NUM,   6, "99",             MS_ERR_SUNS,  sunS) \
+  F (NUM,   8, "99",             MS_ERR_SUNW,  sunW) \
+  F (NUM,  10, "99",             MS_ERR_SUNE,  sunE) \
+  F (FLAG, 12, "J",              MS_ERR_OBSC,  MS_OBSC) \
+  F (NUM,  13, "999",            MS_ERR_DAWN,  dawn) \
+  F (NUM,  16, "99.9",           MS_ERR_WIND,  wind) \
+  F (FLAG, 20, "J",              MS_ERR_RAIN,  MS_RAIN) \
+  F (LIT,  21, "?151515151515?", MS_ERR_FIXED, -) \
+  F (CSUM, 35, "9999",           MS_ERR_CSUM,  -)
+
+enum { K_LIT, K_SIGN, K_NUM, K_FLAG, K_CSUM };
+
+struct field {
+  unsigned char kind, offset;
+  unsigned short err;
+  const char *picture;
+};
+
+#define MAXLEN 64                      /* longest frame, a multiple of 8 */
+#define ONES    0x0101010101010101ULL
+#define HIGH    0x8080808080808080ULL
+#define LOW7    0x7f7f7f7f7f7f7f7fULL
+#define LANES   0x00ff00ff00ff00ffULL
+
+/*
+ * The frame is checked eight bytes at a time. Each class of position
+ * (literal, sign, digit, 'J'/'N') gets a mask with the high bit set in
+ * every byte of that class; the masks are built once from the fields
+ * with memcpy(), so they match the word loads on either byte order.
+ */
+struct layout {
+  int len;                             /* a multiple of 8 */
+  const struct field *field;
+  int nfield;
+  int ready;
+  int csumpos;                         /* checksum covers buf[0..csumpos-1] */
+  unsigned short err[MAXLEN];          /* error bit of each position */
+  struct {
+    uint64_t lit, litval, sign, digit, jn, csum;
+  } mask[MAXLEN / 8];
+};
+
+static void build_masks (struct layout *l) {
+  unsigned char cls[MAXLEN], lit[MAXLEN], csum[MAXLEN];
+  unsigned char m[6][8];
+  const struct field *f;
+  int w, j, i, k;
+
+  memset (cls, ' ', sizeof (cls));
+  memset (lit, 0, sizeof (lit));
+  for (k = 0; k < l->nfield; k++) {
+    f = &l->field[k];
+    for (j = 0; f->picture[j]; j++) {
+      i = f->offset + j;
+      l->err[i] = f->err;
+      switch (f->kind) {
+        case K_LIT:
+          cls[i] = 'L';
+          lit[i] = f->picture[j];
+          break;
+        case K_SIGN:
+          cls[i] = 'S';
+          break;
+        case K_FLAG:
+          cls[i] = 'B';
+          break;
+        case K_NUM:
+        case K_CSUM:
+          cls[i] = (f->picture[j] == '9') ? 'D' : 'L';
+          lit[i] = f->picture[j];
+          break;
+      } /* switch () */
+    }
+    if (f->kind == K_CSUM)
+      l->csumpos = f->offset;
+  }
+  for (i = 0; i < l->len; i++)
+    csum[i] = (i < l->csumpos) ? 0xff : 0;
+
+  for (w = 0; w < l->len / 8; w++) {
+    for (j = 0; j < 8; j++) {
+      i = w * 8 + j;
+      m[0][j] = (cls[i] == 'L') ? 0x80 : 0;
+      m[1][j] = lit[i];
+      m[2][j] = (cls[i] == 'S') ? 0x80 : 0;
+      m[3][j] = (cls[i] == 'D') ? 0x80 : 0;
+      m[4][j] = (cls[i] == 'B') ? 0x80 : 0;
+      m[5][j] = csum[i];
+    }
+    memcpy (&l->mask[w].lit, m[0], 8);
+    memcpy (&l->mask[w].litval, m[1], 8);
+    memcpy (&l->mask[w].sign, m[2], 8);
+    memcpy (&l->mask[w].digit, m[3], 8);
+    memcpy (&l->mask[w].jn, m[4], 8);
+    memcpy (&l->mask[w].csum, m[5], 8);
+  }
+  l->ready = 1;
+}
+/* high bit set in every byte of x that is not zero */
+static inline uint64_t nonzero (uint64_t x) {
+  return (((x & LOW7) + LOW7) | x) & HIGH;
+}
+
+/* high bit set in every byte of x that equals c */
+static inline uint64_t equal (uint64_t x, unsigned char c) {
+  return ~nonzero (x ^ (ONES * c)) & HIGH;
+}
+
+/* high bit set in every byte of x that is '0'..'9' */
+static inline uint64_t isdigit8 (uint64_t x) {
+  uint64_t low = x & LOW7;
+  uint64_t ge0 = low + ONES * (0x80 - '0');
+  uint64_t gt9 = low + ONES * (0x80 - '9' - 1);
+
+  return ge0 & ~gt9 & ~x & HIGH;
+}
+
+/*
+ * Check all positions of the frame and its checksum in one pass and
+ * return the error bitmask (0 if the frame is fine).
+ */
+static inline int layout_validate (struct layout *l, const char *buf, int len) {
+  uint64_t w, bad, acc = 0, neg = 0;
+  unsigned char b[8];
+  int err = (len != l->len) ? MS_ERR_LENGTH : 0;
+  int i, j, sum, val;
+
+  if (!l->ready)
+    build_masks (l);
+
+  for (i = 0; i < l->len / 8; i++) {
+    memcpy (&w, buf + i * 8, 8);
+    bad = (l->mask[i].lit & nonzero (w ^ l->mask[i].litval))
+        | (l->mask[i].sign & ~(equal (w, '+') | equal (w, '-')))
+        | (l->mask[i].digit & ~isdigit8 (w))
+        | (l->mask[i].jn & ~(equal (w, 'J') | equal (w, 'N')));
+    if (bad) {                                                  // rare: find the positions
+      memcpy (b, &bad, 8);
+      for (j = 0; j < 8; j++)
+        if (b[j])
+          err |= l->err[i * 8 + j];
+    }
+    w &= l->mask[i].csum;
+    acc += (w & LANES) + ((w >> 8) & LANES);                    // 4 lanes of 16 bit
+    neg += (w & HIGH) >> 7;
+  }
+  sum = (int)((acc * 0x0001000100010001ULL) >> 48);
+#if CHAR_MIN < 0
+  /* the checksum used to be summed over (signed) char */
+  sum -= 256 * (int)((neg * ONES) >> 56);
+#endif
+
+  if (err & MS_ERR_CSUM)
+    return err | MS_ERR_CSUMVAL;
+
+  /*
+   * same as atoi(buf+csumpos): digits beyond the field count too, up to
+   * the NUL at len; past 100000 the value cannot match any more
+   */
+  for (val = 0, i = l->csumpos; buf[i] >= '0' && buf[i] <= '9' && val < 100000; i++)
+    val = val * 10 + buf[i] - '0';
+  if (sum != val)
+    err |= MS_ERR_CSUMVAL;
+  return err;
+}
+
+/*
+ * the digits of picture at s; picture and n are constants, so the loop
+ * is unrolled and folds into the same code as hand written offsets
+ */
+static inline int field_num (const char *s, const char *picture, int n) {
+  int v = 0, i;
+
+#pragma GCC unroll 16
+  for (i = 0; i < n; i++)
+    if (picture[i] == '9')
+      v = v * 10 + s[i] - '0';
+  return v;
+}
+
+/* one statement per field, straight from the fixed positions */
+#define DECODE(_K_, _O_, _P_, _E_, _T_) DECODE_##_K_ (_O_, _P_, _T_)
+#define DECODE_LIT(_O_, _P_, _T_)
+#define DECODE_CSUM(_O_, _P_, _T_)
+#define DECODE_SIGN(_O_, _P_, _T_) neg = (buf[_O_] == '-');
+#define DECODE_NUM(_O_, _P_, _T_) \
+  smp->_T_ = neg ? -field_num (buf + (_O_), _P_, sizeof (_P_) - 1) : field_num (buf + (_O_), _P_, sizeof (_P_) - 1); \
+  neg = 0;
+#define DECODE_FLAG(_O_, _P_, _T_) smp->flags |= (buf[_O_] == 'J') ? (_T_) : 0;
+
+#define FIELD(_K_, _O_, _P_, _E_, _T_) { K_##_K_, _O_, _E_, _P_ },
+
+/*
+ * <name>_validate () checks a frame of the layout and returns its error
+ * bits, <name>_decode () decodes one that passed; buf is left untouched
+ */
+#define MS_LAYOUT(_NAME_, _LEN_, _FIELDS_) \
+  static const struct field _NAME_##_fields[] = { _FIELDS_ (FIELD) }; \
+  static struct layout _NAME_##_layout = { \
+    _LEN_, _NAME_##_fields, sizeof (_NAME_##_fields) / sizeof (_NAME_##_fields[0]) \
+  }; \
+  int _NAME_##_validate (const char *buf, int len) { \
+    return layout_validate (&_NAME_##_layout, buf, len); \
+  } \
+  void _NAME_##_decode (const char *buf, struct ms_sample *smp) { \
+    int neg = 0; \
+    smp->flags = 0; \
+    _FIELDS_ (DECODE) \
+    (void)neg; \
+  }
+
+/* ms_validate () and ms_decode (), the Eltako Multisensor MS */
+MS_LAYOUT (ms, MS_DGRAMLEN, ELTAKO_MS)
+
+/* value of one channel; flags are 0 or 1 */
+int ms_channel (const struct ms_sample *smp, int ch) {
+  switch (ch) {
+    case CH_TEMP: return smp->temp;
+    case CH_WIND: return smp->wind;
+    case CH_RAIN: return (smp->flags & MS_RAIN) ? 1 : 0;
+    case CH_SUNE: return smp->sunE;
+    case CH_SUNS: return smp->sunS;
+    case CH_SUNW: return smp->sunW;
+    case CH_DAWN: return smp->dawn;
+    case CH_OBSC: return (smp->flags & MS_OBSC) ? 1 : 0;
+  }
+  return 0;
+}
@@ -0,0 +1,72 @@
+/*
+ * datagram.h - validation of Eltako Multisensor datagrams
+ *
+ * This software is copyright 2008 by Frank Sautter
+ * (eltakoms~at~sautter~dot~com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ */
+
+#ifndef DATAGRAM_H
+#define DATAGRAM_H
+
+#include <stdint.h>
+
+/*
+ * A datagram is 40 bytes long:
+ *    W+07.6016300N99901.2N?151515151515?1889<ETX>
+ * The error bits below are reported in syslog and must not change.
+ */
+#define MS_DGRAMLEN    40
+
+#define MS_ERR_LENGTH  0x0001          /* incorrect length */
+#define MS_ERR_SYNC    0x0002          /* no 'W' on pos 1 */
+#define MS_ERR_SIGN    0x0004          /* no '+' or '-' on pos 2 */
+#define MS_ERR_TEMP    0x0008          /* temperature not "dd.d" */
+#define MS_ERR_SUNS    0x0010          /* sun south not numeric */
+#define MS_ERR_SUNW    0x0020          /* sun west not numeric */
+#define MS_ERR_SUNE    0x0040          /* sun east not numeric */
+#define MS_ERR_OBSC    0x0080          /* no 'J' or 'N' on pos 13 */
+#define MS_ERR_DAWN    0x0100          /* dawn not numeric */
+#define MS_ERR_WIND    0x0200          /* wind not "dd.d" */
+#define MS_ERR_RAIN    0x0400          /* no 'J' or 'N' on pos 21 */
+#define MS_ERR_FIXED   0x0800          /* no "?151515151515?" on pos 22-35 */
+#define MS_ERR_CSUM    0x1000          /* checksum not numeric */
+#define MS_ERR_CSUMVAL 0x2000          /* erroneous checksum */
+
+/*
+ * A decoded datagram. Temperature and wind are kept in tenths of a
+ * degree celsius / meter per second. The fields are ordered so the
+ * struct has no padding.
+ */
+struct ms_sample {
+  int16_t temp;                        /* -999 .. +999 */
+  uint16_t wind;                       /* 0 .. 999 */
+  uint16_t dawn;                       /* 0 .. 999 */
+  uint8_t sunS, sunW, sunE;            /* 0 .. 99 */
+  uint8_t flags;                       /* MS_RAIN, MS_OBSC */
+};
+
+#define MS_RAIN        0x01            /* raining ('J' on pos 21) */
+#define MS_OBSC        0x02            /* pitch black ('J' on pos 13) */
+
+/* channels of a sample, in the DS order of weather.rrd */
+enum {
+  CH_TEMP, CH_WIND, CH_RAIN, CH_SUNE, CH_SUNS, CH_SUNW, CH_DAWN, CH_OBSC,
+  CH_COUNT
+};
+
+/*
+ * buf must hold at least MS_DGRAMLEN bytes and be NUL terminated at len,
+ * as handed out by framer_next(). Both are generated from the field list
+ * of the frame layout in datagram.c; another layout added there with
+ * MS_LAYOUT () gets its own <name>_validate () and <name>_decode ().
+ */
+int ms_validate (const char *buf, int len);
+void ms_decode (const char *buf, struct ms_sample *smp);
+int ms_channel (const struct ms_sample *smp, int ch);
+
+#endif /* DATAGRAM_H */
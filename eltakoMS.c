@@ -45,14 +45,34 @@
 #include <stdio.h>
 #include <fcntl.h>
 #include <string.h>
+#include <errno.h>
 #include <sys/types.h>
 #include <sys/time.h>
+#include <poll.h>
+#include <pthread.h>
 #include <syslog.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <time.h>
 #include "config.h"
 #include "version.h"
+#include "frame.h"
+#include "datagram.h"
+#include "status.h"
+#include "logfile.h"
+#include "aggregate.h"
+#include "rollup.h"
+#include "binlog.h"
+#include "samplelog.h"
+#include "checkpoint.h"
+#include "history.h"
+#include "msglog.h"
+#include "queue.h"
+#include "sink.h"
+#include "rules.h"
+#include "conffile.h"
+#include "stats.h"
+#include "timestamp.h"
 
 /* select which terminal handling to use (currently only SysV variants) */
 #if defined(HAVE_TERMIOS)
@@ -61,6 +81,11 @@
 #define TTY_SETATTR(_FD_, _ARG_) tcsetattr((_FD_), TCSANOW, (_ARG_))
 #endif
 
+#if defined(__linux__)
+#include <sys/ioctl.h>
+#include <linux/serial.h>
+#endif
+
 #if defined(HAVE_TERMIO)
 #include <termio.h>
 #include <sys/ioctl.h>
@@ -72,350 +97,1151 @@
 MUST DEFINE ONE OF "HAVE_TERMIOS" or "HAVE_TERMIO"
 #endif
 
-#define LINELEN 150
-#define DEFTTY  "/dev/ttyS1"
-#define DEFLOG  "/usb/log"
-#define DEFSHM  "/dev/shm"
+#define OPTIONS "C:f:l:i:F:T:R:Q:b:S:D:r:x:c:o:A:B:X:W:d:e:P:Y:LNHsZmMV"
+#define BATCH   64                      /* samples per sink_write () */
+#define REOPEN_MIN 1                    /* s before a failed tty is opened again, */
+#define REOPEN_MAX 60                   /* doubled on every failure up to this */
 
 void usage (char *prog) {
-  printf ("usage: %s [ -V ] [ -s ] [ -l <logfile> ] [ -f <device> ]\n", prog);
+  printf ("usage: %s [ -V ] [ -C <conffile> ] [ -s ] [ -Y <syslogd> ] [ -Z ] [ -m | -M ] [ -H ] [ -B <baud> ] [ -X byte | frame ] [ -L ] [ -N ] [ -W <sec> ] [ -d <deadbands> [ -e <sec> ] ] [ -l <logfile> ] [ -F <n> ] [ -T <sec> ] [ -R <sec>:<rrd> [ -Q <rrdcached> ] ]\n"
+          "\t[ -b <binlog> ] [ -S <samplelog> [ -D <n> | -D change ] ] [ -o <sink> ] [ -A <rule> ] [ -P <port> ] [ -c <capture> | -r <capture> [ -x <rate> ] ] [ -f <device> ... ]\n", prog);
   printf ("\tdefault device: "DEFTTY"\n");
+  printf ("\t-C <conffile>\tread settings from <conffile>, again on SIGHUP\n");
+  printf ("\t-f <device>\tread from <device>; repeat for more sensors\n");
+  printf ("\t-B <baud>\tbaud rate of the devices (default 19200)\n");
+  printf ("\t-X <mode>\tbyte: wake up for every byte received (default),\n"
+          "\t\tframe: let the kernel collect a whole datagram first\n");
+  printf ("\t-L\tswitch the uarts to low latency mode\n");
+  printf ("\t-N\tno RTS/CTS hardware flow control\n");
+  printf ("\t-W <sec>\tmark the status stale after <sec> seconds without datagrams (default 10, 0 = never)\n");
+  printf ("\t-d <deadbands>\tupdate status, sinks and samplelog only if a channel moved by its delta,\n"
+          "\t\te.g. temp=0.2,wind=0.5,dawn=10 (other channels: on any change)\n");
+  printf ("\t-e <sec>\twith -d publish a datagram at least every <sec> seconds (default 60, 0 = never)\n");
   printf ("\t-l <logfile>\tuse specified <logfile>\n");
   printf ("\t-i <interval>\tuse specified <interval> for logging\n");
+  printf ("\t-F <n>\tflush logfile every <n> records (default 1, 0 = never)\n");
+  printf ("\t-T <sec>\tflush logfile after <sec> seconds (default 0 = never)\n");
+  printf ("\t-b <binlog>\talso log intervals to binary <binlog> (see eltakoMS-dump)\n");
+  printf ("\t-S <samplelog>\tlog every datagram in a compact binary format to <samplelog>\n");
+  printf ("\t-D <n>\tlog every <n>th datagram only, or with \"change\" those that differ\n");
+  printf ("\t-R <sec>:<rrd>\tupdate <rrd> with a rollup every <sec> seconds (repeatable)\n");
+  printf ("\t-Q <rrdcached>\tsend the rollups to rrdcached at unix:<path> or <host>[:<port>]\n"
+          "\t\tinstead of running "RRDTOOL"\n");
+  printf ("\t-o <sink>\tsend every datagram to influx:<host>[:<port>] (line protocol over UDP)\n"
+          "\t\tor mqtt:<host>[:<port>][/<topic>] (repeatable)\n");
+  printf ("\t-A <rule>\talarm rule checked on every datagram (repeatable), e.g.\n"
+          "\t\twind>10.0/3,8.0:exec:<cmd>, rain>0:udp:<host>:<port> or dawn<50\n");
+  printf ("\t-P <port>\tserve Prometheus metrics of the daemon itself on <port> (startup only)\n");
   printf ("\t-s\tuse syslog instead of logfile\n");
+  printf ("\t-Y <syslogd>\tsend bad datagrams, alarms and with -s the intervals to /dev/log (default),\n"
+          "\t\tunix:<path> or <host>[:<port>] (UDP)\n");
+  printf ("\t-Z\tformat these messages after RFC 5424 with structured data\n");
+  printf ("\t-c <capture>\tappend the raw bytes read from <device> to <capture>\n");
+  printf ("\t-r <capture>\treplay <capture> instead of reading <device>\n");
+  printf ("\t-x <rate>\treplay <rate> datagrams per second (default: as fast as possible)\n");
+  printf ("\t-m\tmap binary status record and text view into "DEFSHM"\n");
+  printf ("\t-M\tmap binary status record only\n");
+  printf ("\t-H\tkeep the last datagrams and their 1 min, 10 min and 1 h extremes in <shmfile>.hist\n");
   printf ("\t-V\tprint version and exit\n");
+  printf ("\twith several devices -l, -b, -c and -R files get \"-<tty>\" inserted before\n"
+          "\tthe extension, e.g. weather-ttyS2.rrd\n");
 }
 
+/* everything that belongs to one sensor */
+struct sensor {
+  char device[CONF_PATHLEN];           /* "" = slot is free */
+  char *tty;                           /* basename of device */
+  char tag[40];                        /* syslog prefix */
+  char lock[CONF_PATHLEN + 40];
+  char logf[CONF_PATHLEN + 40];
+  char binlogf[CONF_PATHLEN + 40];
+  char samplelogf[CONF_PATHLEN + 40];
+  char capturef[CONF_PATHLEN + 40];
+  int fd;
+  struct framer framer;
+  struct status status;
+  struct aggregator agg;
+  struct logfile logfile;
+  struct binlog binlog;
+  struct samplelog samplelog;
+  struct rollup rollup;
+  struct ckpt ckpt;
+  struct history history;
+  unsigned int dropped;                /* datagrams lost to a full queue */
+  struct rules rules;                  /* used by the reader */
+  uint32_t alarms;                     /* last alarms seen by the writer */
+  struct deadband_state published;     /* last datagram that passed the deadbands */
+  time_t lastgood;                     /* last valid datagram, for the writer */
+  int stale;
+  int64_t lastbyte;                    /* ms, monotonic; the reader's */
+  int64_t reopen;                      /* ms, monotonic; 0 = tty is fine */
+  int backoff;                         /* s */
+  struct ms_sensor_stats *stats;       /* counters of the reader */
+  struct msglog_errors errors;         /* bad datagrams in this interval */
+};
 
 /* must be global variables */
-char lock[80] = LOCKPATH;
-int fd;
+struct conf conf;
+char *conffile = NULL;
+char *program;
+struct sensor sensor[CONF_MAXDEV];
+int nsensor = 0;                       /* slots in use, some may be free */
 int use_syslog = 0; /* default: use logfile */
+struct queue queue;
+struct rule rule[RULES_MAX];
+int nrule = 0;
+struct deadband deadband;
+struct sink sink[SINK_MAX];
+int nsink = 0;
+struct sink_sample batch[BATCH];
+int nbatch = 0;
+struct ms_stats *stats;
+struct msglog wlog;                    /* syslog of the writer */
+struct ts_cache logtime;               /* of the writer */
+volatile sig_atomic_t got_term = 0;
+volatile sig_atomic_t got_sighup = 0;
+volatile sig_atomic_t got_sigusr1 = 0;
+
+void reopenfiles () {
+  got_sighup = 1;
+}
+
+void flushfiles () {
+  got_sigusr1 = 1;
+}
 
 void closefiles () {
+  got_term = 1;
+}
+
+/* close the device and all outputs of a sensor and free its slot */
+void sensor_close (struct sensor *sn) {
+  if (!use_syslog)
+    log_close (&sn->logfile);
+  if (sn->fd != -1)
+    close (sn->fd);
+  if (sn->framer.tee != -1)
+    close (sn->framer.tee);
+  rollup_close (&sn->rollup);
+  binlog_close (&sn->binlog);
+  samplelog_close (&sn->samplelog);
+  ckpt_close (&sn->ckpt);
+  history_close (&sn->history);
+  status_close (&sn->status);
+  if (sn->lock[0])
+    unlink (sn->lock);
+  sn->fd = sn->framer.tee = -1;
+  sn->lock[0] = sn->device[0] = '\0';
+  sn->stats->tty[0] = '\0';
+}
+
+/*
+ * Close everything and exit with code: 0 when told to stop, 1 on
+ * errors, 2 if a device could not be locked (see lock_device ()).
+ * The writer thread must not be running.
+ */
+void cleanup (int code) {
+  int i;
+
   signal (SIGTERM, SIG_IGN);
   signal (SIGHUP, SIG_IGN);
   signal (SIGINT, SIG_IGN);
   signal (SIGQUIT, SIG_IGN);
+  signal (SIGUSR1, SIG_IGN);
   if (use_syslog) {
-    syslog (LOG_INFO, "caught signal, exiting");
+    syslog (LOG_INFO, "exiting, queue peak %u, %u datagrams dropped", queue.peak, queue.dropped);
     closelog();
+  }
+  for (i = 0; i < nsensor; i++)
+    if (sensor[i].device[0])
+      sensor_close (&sensor[i]);
+  for (i = 0; i < nsink; i++)
+    sink_close (&sink[i]);
+  msglog_close (&wlog);
+  exit (code);
+}
+
+/*
+ * Name of a per sensor file: with more than one sensor "-<tty>" is
+ * inserted before the extension of path.
+ */
+void devpath (char *out, int size, const char *path, const char *tty) {
+  const char *base = strrchr (path, '/');
+  const char *ext = strrchr (base ? base : path, '.');
+
+  if (conf.ndevice <= 1)
+    snprintf (out, size, "%s", path);
+  else if (ext == NULL || ext == base + 1 || ext == path)
+    snprintf (out, size, "%s-%s", path, tty);
+  else
+    snprintf (out, size, "%.*s-%s%s", (int)(ext - path), path, tty, ext);
+}
+
+/* log one closed interval; intervals without valid datagrams are logged as gap */
+void write_record (const struct agg_record *rec, void *arg) {
+  struct sensor *sn = arg;
+  struct binlog_rec r;
+  char datestr[TS_DATELEN + 1];
+  char values[40];
+  char line[LINELEN];
+  time_t epoch = rec->start + rec->interval;
+
+  status_interval (&sn->status, rec);
+  msglog_errors (&wlog, &sn->errors, sn->tty, sn->tag);         // at most one message per error code
+  binlog_fill (&r, rec);
+  binlog_append (&sn->binlog, &r);
+  binlog_values (values, sizeof (values), &r);
+
+  if (use_syslog) {
+    msglog_send (&wlog, LOG_INFO, "interval", sn->tty, "%s: %s", sn->tag, values);
+  } else {
+    ts_format (&logtime, epoch, datestr);
+    snprintf (line, sizeof (line), "%s %s\n", datestr, values);
+    log_write (&sn->logfile, line, epoch);
+  } /* if (use_syslog) */
+}
+
+/*
+ * validate and decode one datagram into e and check the alarm rules
+ * right away, so their actions never wait for the writer; returns the
+ * error bits
+ */
+int read_frame (struct q_entry *e, int n, const char *buf, int len, const struct stamp *ts) {
+  struct sensor *sn = &sensor[n];
+  time_t t = ts_steady (ts);
+
+  e->t = t;
+  e->ts = *ts;
+  e->sensor = n;
+  sn->stats->frames++;
+  if ((e->err = ms_validate (buf, len)) == 0) {				// sanity checks
+    sn->stats->good++;
+    ms_decode (buf, &e->smp);
+    e->alarms = rules_check (&sn->rules, &e->smp, t, sn->tty);
   } else {
-    close (fd);
+    stats_count_errors (sn->stats, e->err);
+    snprintf (e->raw, sizeof (e->raw), "%.*s", (int)sizeof (e->raw) - 1, buf);
   }
-  unlink (lock);
-  exit (0);
+  return e->err;
 }
 
-void copyright (char *prog) {
-  printf ("%s ver %s\n", prog, VERSION);
-  printf ("Copyright (c) 2008 Frank Sautter; (c) 1996 Harald Milz\n");
-  exit (0);
+/* hand the samples collected so far to every sink */
+void write_batch (time_t now) {
+  int i;
+
+  for (i = 0; i < nsink; i++)
+    sink_write (&sink[i], batch, nbatch, now);
+  nbatch = 0;
 }
 
+/* account one datagram in the status, interval, rollups and sinks */
+void handle_sample (struct sensor *sn, const struct q_entry *e) {
+  struct ms_queue_stat qs;
+  uint32_t changed;
+  int publish, i;
 
-int main (int argc, char **argv) {
+  if (e->err == 0 && sn->stale) {
+    msglog_send (&wlog, LOG_INFO, "stale", sn->tty, "%s: datagrams again", sn->tag);
+    sn->stale = 0;
+    sn->published.have = 0;                                     // publish it, the status says stale
+  }
+  if (e->err) {                                                 // summed up in write_record ()
+    msglog_error (&sn->errors, e->err, e->raw);
+    return;
+  }
+  sn->lastgood = e->t;
+  publish = deadband_pass (&deadband, &sn->published, &e->smp, e->t);
+  if ((changed = e->alarms ^ sn->alarms)) {
+    for (i = 0; i < nrule; i++)
+      if (changed & (1u << i))
+        msglog_send (&wlog, LOG_INFO, "alarm", sn->tty, "%s: alarm %s %s", sn->tag, rule[i].cond,
+                     (e->alarms & (1u << i)) ? "on" : "off");
+    sn->alarms = e->alarms;
+    publish = 1;                                                // the status has the alarm bits
+  }
+  if (publish) {
+    qs.queued = queue_fill (&queue);
+    qs.peak = __atomic_load_n (&queue.peak, __ATOMIC_RELAXED);
+    qs.dropped = __atomic_load_n (&sn->dropped, __ATOMIC_RELAXED);
+    status_update (&sn->status, &e->smp, e->ts.real.tv_sec, e->alarms, &qs);
+    samplelog_add (&sn->samplelog, &e->smp, e->ts.real.tv_sec);
+  }
+  agg_add (&sn->agg, &e->smp, e->t, write_record, sn);
+  rollup_sample (&sn->rollup, &e->smp, e->t);
+  history_add (&sn->history, &e->smp, e->t);
+  ckpt_save (&sn->ckpt, &sn->agg, &sn->rollup, e->t);
 
-#if defined(HAVE_TERMIOS) || defined(STREAM)
-  struct termios term;
-#endif
-#if defined(HAVE_TERMIO) || defined(HAVE_SYSV_TTYS)
-  struct termio term;
-#endif
-  char buf[LINELEN];
-  char device[LINELEN] = DEFTTY;
-  char logf[LINELEN];
-  char shmf[LINELEN];
-  char proc[21];
-  int interval = 60;
-  int pid;
-  FILE *lockfile;
-  FILE *logfile;
-  FILE *procfile;
-  FILE *shmfile;
-  fd_set fds;
-  char c;
-  char *s;
-  char *program = argv[0];
-  char *tty;
-  time_t ltime, epoch;
-  char datestr[80];
-  char bufcpy[LINELEN];
-  int autoname = 1;
-  int err, i, sum, count, temp, wind, dawn, sunS, sunE, sunW, avgTemp,
-    maxWind, avgDawn, avgSunS, avgSunE, avgSunW;
-  long oldEpoch, accDawn, accSunE, accSunW, accSunS, accTemp;
-  char rain, obsc, maxRain, maxObsc;
+  if (nsink && publish) {
+    batch[nbatch].ts = e->ts;
+    batch[nbatch].sensor = sn->tty;
+    batch[nbatch].smp = e->smp;
+    if (++nbatch == BATCH)
+      write_batch (e->t);
+  }
+}
 
-  /* remove the dirpath from the program name */
-  if ((s = strrchr (program, '/')))
-    program = ++s;
+/*
+ * The writer thread owns all outputs: status file, logfile, syslog
+ * (msglog.h), binary log, rollups and sinks. It handles what the reader
+ * queued and closes intervals by the clock, so a slow disk or syslog
+ * never stalls reading the ttys. It returns after the reader closed the queue and everything
+ * queued has been written, for good or to let the reader reconfigure.
+ */
+void *writer (void *arg) {
+  struct sensor *sn;
+  struct q_entry e;
+  time_t ltime, deadline, next;
+  int i;
 
-  while ((c = getopt (argc, argv, "f:l:i:tsV")) != 255) {
-    switch (c) {
-      case 'f':
-        strcpy (device, optarg);
-        break;
-      case 'V':
-        copyright(program);
-        break;
-      case 's':
-        use_syslog = 1;
-        break;
-      case 'l':
-        strcpy (logf, optarg);
-        use_syslog = 0;
-        autoname = 0;
-        break;
-      case 'i':
-        interval = atoi(optarg);
-        if (interval < 10) {
-          printf ("interval to short.\n");
-          exit (1);
-        }
-        break;
-      default:
-        printf ("found %i\n", c);
-        usage (program);
-        exit (1);
-        break;
-    } /* switch () */
-  } /* while getopt */
+  do {
+    while (queue_pop (&queue, &e))
+      handle_sample (&sensor[e.sensor], &e);
+    ltime = ts_now ();
+    if (nbatch)
+      write_batch (ltime);
 
-  tty = ((s = strrchr (device, '/'))) ? ++s : device; 
-  sprintf (shmf, "%s/%s-%s", DEFSHM, program, tty);
+    if (got_sigusr1) {
+      got_sigusr1 = 0;
+      for (i = 0; i < nsensor; i++) {
+        if (!use_syslog)
+          log_flush (&sensor[i].logfile);
+        log_flush (&sensor[i].samplelog.lf);
+      }
+    }
 
-  if (autoname)
-    sprintf (logf, "%s/%s-%s.log", DEFLOG, program, tty);
+    /* close intervals by the clock, even if no datagrams arrive */
+    ltime = ts_now ();
+    deadline = ltime + 3600;
+    for (i = 0; i < nsensor; i++) {
+      sn = &sensor[i];
+      if (!sn->device[0])
+        continue;
+      agg_tick (&sn->agg, ltime, write_record, sn);
+      rollup_tick (&sn->rollup, ltime);
+      history_tick (&sn->history, ltime);
+      ckpt_save (&sn->ckpt, &sn->agg, &sn->rollup, ltime);
+      if (!use_syslog)
+        log_tick (&sn->logfile, ltime);
+      log_tick (&sn->samplelog.lf, ltime);
+      if (conf.stale && !sn->stale) {
+        if (ltime - sn->lastgood >= conf.stale) {
+          msglog_send (&wlog, LOG_WARNING, "stale", sn->tty, "%s: no datagrams for %d s", sn->tag,
+                       (int)(ltime - sn->lastgood));
+          sn->stale = 1;
+          status_stale (&sn->status, 1);
+        } else if (sn->lastgood + conf.stale < deadline)
+          deadline = sn->lastgood + conf.stale;
+      }
 
-  if (use_syslog) {
-    openlog (program, LOG_PID, LOG_LOCAL5);
-  } else {
-    if ((logfile = fopen (logf, "a")) == NULL) {
-      fprintf (stderr, "cannot open %s for logging\n", logf);
-      perror ("fopen");
-      exit (1);
+      if (agg_deadline (&sn->agg) < deadline)
+        deadline = agg_deadline (&sn->agg);
+      if ((next = rollup_deadline (&sn->rollup)) && next < deadline)
+        deadline = next;
+      if ((next = history_deadline (&sn->history)) && next < deadline)
+        deadline = next;
+      if (sn->logfile.pending && sn->logfile.flush_t && sn->logfile.flushed + sn->logfile.flush_t < deadline)
+        deadline = sn->logfile.flushed + sn->logfile.flush_t;
+      if (sn->samplelog.lf.pending && sn->samplelog.lf.flushed + sn->samplelog.lf.flush_t < deadline)
+        deadline = sn->samplelog.lf.flushed + sn->samplelog.lf.flush_t;
     }
-    fclose (logfile);
+    for (i = 0; i < nsink; i++) {
+      sink_tick (&sink[i], ltime);
+      if ((next = sink_deadline (&sink[i])) && next < deadline)
+        deadline = next;
+    }
+  } while (queue_wait (&queue, (deadline > ltime) ? (deadline - ltime) * 1000 : 0));
+  return NULL;
+}
+
+/*
+ * Feed a capture of raw tty bytes through the same framing, validation
+ * and aggregation. The sensor sends one datagram per second, so the
+ * clock advances by a second per datagram; both clocks of the stamps
+ * are that made up time. Datagrams are replayed as
+ * fast as possible, or at rate datagrams per second measured from the
+ * start, however long each one takes to handle.
+ */
+int replay (struct sensor *sn, const char *file, int rate) {
+  struct timespec start, stop, due;
+  struct q_entry e;
+  struct stamp ts;
+  char buf[LINELEN];
+  long frames = 0, bad = 0;
+  time_t t = time(NULL);
+  double secs;
+  int64_t ns;
+  int rfd, len;
+
+  if ((rfd = open (file, O_RDONLY)) == -1) {
+    fprintf (stderr, "cannot open %s\n", file);
+    perror ("open");
+    return 1;
   }
-	
-  /* check for a valid UUCP lock file */
-  s = strrchr (device, '/');
-  s++;
-  strcat (lock, "/LCK..");
-  strcat (lock, s);
-  if ((lockfile = fopen (lock, "r")) != NULL ) { /* does exist */
+  t -= t % sn->agg.interval;
+  ts_offset = 0;                                                // steady = mono = t
+  memset (&ts, 0, sizeof (ts));
+  agg_init (&sn->agg, sn->agg.interval, t);
+  framer_init (&sn->framer);
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  while ((len = framer_fill (&sn->framer, rfd)) > 0) {
+    sn->stats->bytes += len;
+    while ((len = framer_next (&sn->framer, buf, LINELEN)) > 0) {
+      ts.real.tv_sec = ts.mono.tv_sec = t++;
+      if (read_frame (&e, 0, buf, len, &ts))
+        bad++;
+      handle_sample (sn, &e);
+      frames++;
+      if (rate) {                                               // the next one is due at start + frames / rate
+        ns = ts_ns (&start) + frames * 1000000000LL / rate;
+        due.tv_sec = ns / 1000000000;
+        due.tv_nsec = ns % 1000000000;
+        while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) == EINTR)
+          ;
+      }
+    }
+  }
+  agg_tick (&sn->agg, agg_deadline (&sn->agg), write_record, sn);	// close the last interval
+  rollup_finish (&sn->rollup);
+  write_batch (t);
+  clock_gettime (CLOCK_MONOTONIC, &stop);
+  close (rfd);
+
+  secs = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9;
+  fprintf (stderr, "replayed %ld datagrams (%ld bad) in %.3f s, %.0f datagrams/s\n",
+           frames, bad, secs, (secs > 0) ? frames / secs : 0.0);
+  return 0;
+}
+
+/* check for a valid UUCP lock file and create our own */
+int lock_device (struct sensor *sn) {
+  FILE *lockfile;
+  FILE *procfile;
+  char proc[21];
+  int pid;
+
+  snprintf (sn->lock, sizeof (sn->lock), "%s/LCK..%s", conf.lockdir, sn->tty);
+  if ((lockfile = fopen (sn->lock, "r")) != NULL ) { /* does exist */
     fscanf (lockfile, "%11d", &pid);
     sprintf (proc, "/proc/%d/cmdline", pid);
     if ((procfile = fopen (proc, "r")) == NULL) { /* process doesn't exist */
-      fprintf (stderr, "stale lockfile exists: %s, pid %d\n", lock, pid);
+      fprintf (stderr, "stale lockfile exists: %s, pid %d\n", sn->lock, pid);
       if (use_syslog) {
-        syslog (LOG_ERR, "stale lockfile exists: %s, pid %d", lock, pid);
+        syslog (LOG_ERR, "stale lockfile exists: %s, pid %d", sn->lock, pid);
       }
       fclose (lockfile);
-      unlink (lock);
+      unlink (sn->lock);
     } else {
-      fprintf (stderr, "valid lockfile exists: %s, pid %d\n", lock, pid);
+      fprintf (stderr, "valid lockfile exists: %s, pid %d\n", sn->lock, pid);
       if (use_syslog) {
-        syslog (LOG_ERR, "valid lockfile exists: %s, pid %d", lock, pid);
+        syslog (LOG_ERR, "valid lockfile exists: %s, pid %d", sn->lock, pid);
       }
+      fclose (procfile);
       fclose (lockfile);
-      exit (2);
+      sn->lock[0] = '\0';                                       // not ours
+      return -1;
     }
   }
 	
   /* create new PID file */
-  lockfile = fopen (lock, "w");
+  if ((lockfile = fopen (sn->lock, "w")) == NULL) {
+    syslog (LOG_ERR, "cannot create lockfile %s", sn->lock);
+    sn->lock[0] = '\0';
+    return -1;
+  }
   fprintf (lockfile, "%11d", getpid());
   fclose (lockfile);
-	
-  /* open the serial device */
-  if ((fd = open (device, O_RDONLY | O_NDELAY)) == -1) {
-    if (use_syslog)
-      syslog (LOG_ERR, "cannot open %s", device);
+  return 0;
+}
 
-    fprintf (stderr, "cannot open %s\n", device);
-    perror ("open");
-    exit (1);
-  }
-  fcntl (fd, F_SETFL, O_RDONLY);
-  if (use_syslog)
-    syslog (LOG_INFO, "startup, logging from %s into %s\n", device, logf);
+/*
+ * ASYNC_LOW_LATENCY makes the serial driver push received bytes to the
+ * tty layer at once instead of after its own timer; not every driver
+ * (and no pty) knows it, so failing is not an error.
+ */
+void set_lowlatency (struct sensor *sn, int on) {
+#if defined(TIOCGSERIAL) && defined(ASYNC_LOW_LATENCY)
+  struct serial_struct ss;
+
+  if (ioctl (sn->fd, TIOCGSERIAL, &ss) == -1)
+    return;
+  if (on)
+    ss.flags |= ASYNC_LOW_LATENCY;
   else
-    fprintf (stderr, "startup, reading from %s into %s\n", device, logf);
+    ss.flags &= ~ASYNC_LOW_LATENCY;
+  if (ioctl (sn->fd, TIOCSSERIAL, &ss) == -1)
+    syslog (LOG_INFO, "%s: no low latency mode on %s", sn->tag, sn->device);
+#endif
+}
 
-  /* setup TTY (19200 bps, 8N1) */
-  if (TTY_GETATTR(fd,  &term) == -1) {
-    if (use_syslog)
-      syslog (LOG_ERR, "error in tcgetattr");
+/*
+ * Raw mode, 8N1 at the configured baud rate. In the frame receive mode
+ * VMIN is a datagram, so poll () only reports the tty readable once
+ * MS_DGRAMLEN bytes are waiting: one wakeup per datagram instead of one
+ * per byte (or per few bytes, depending on the uart fifo).
+ */
+int set_tty (struct sensor *sn, const struct conf *cf) {
+#if defined(HAVE_TERMIOS) || defined(STREAM)
+  struct termios term;
+#endif
+#if defined(HAVE_TERMIO) || defined(HAVE_SYSV_TTYS)
+  struct termio term;
+#endif
 
+  if (TTY_GETATTR(sn->fd,  &term) == -1) {
+    syslog (LOG_ERR, "error in tcgetattr");
     perror("tcgetattr");
-    exit(1);
+    return -1;
   }
 
   memset(term.c_cc, 0, sizeof(term.c_cc));
-  term.c_cc[VMIN] = 1;             /* read ONE character */
-  term.c_cc[VTIME] = 5;            /* read timeout 5/10 sec */
-  term.c_cflag = B19200|CS8|CREAD|CLOCAL|CRTSCTS;
+  if (cf->rxmode == CONF_RX_FRAME) {
+    term.c_cc[VMIN] = MS_DGRAMLEN; /* a whole datagram */
+    term.c_cc[VTIME] = 0;          /* no timer, it would make poll () wake up for every byte */
+  } else {
+    term.c_cc[VMIN] = 1;           /* read ONE character */
+    term.c_cc[VTIME] = 5;          /* read timeout 5/10 sec */
+  }
+  term.c_cflag = conf_baud (cf->baud)|CS8|CREAD|CLOCAL|(cf->rtscts ? CRTSCTS : 0);
   term.c_iflag = IGNBRK;
   term.c_oflag = 0;
   term.c_lflag = 0;
 
-  if (TTY_SETATTR(fd, &term) == -1) {
+  if (TTY_SETATTR(sn->fd, &term) == -1) {
+    syslog (LOG_ERR, "error in tcsetattr");
+    perror("tcsetattr");
+    return -1;
+  }
+  set_lowlatency (sn, cf->lowlatency);
+  return 0;
+}
+
+/* open the serial device and set it up */
+int open_device (struct sensor *sn) {
+  if ((sn->fd = open (sn->device, O_RDONLY | O_NDELAY)) == -1) {
     if (use_syslog)
-      syslog (LOG_ERR, "error in tcsetattr");
+      syslog (LOG_ERR, "cannot open %s", sn->device);
 
-    perror("tcsetattr");
-    exit(1);
+    fprintf (stderr, "cannot open %s\n", sn->device);
+    perror ("open");
+    return -1;
+  }
+  /* stays non-blocking, so a read never waits for bytes that do not come */
+  if (use_syslog)
+    syslog (LOG_INFO, "startup, logging from %s into %s\n", sn->device, sn->logf);
+  else
+    fprintf (stderr, "startup, reading from %s into %s\n", sn->device, sn->logf);
+
+  return set_tty (sn, &conf);
+}
+
+/* a tty that failed is closed and tried again after backoff seconds */
+void device_failed (struct sensor *sn, int64_t now, const char *why) {
+  syslog (LOG_ERR, "%s: %s on %s, reopening in %d s", sn->tag, why, sn->device, sn->backoff);
+  close (sn->fd);
+  sn->fd = -1;
+  framer_discard (&sn->framer);
+  sn->stats->partials = sn->framer.partials;
+  sn->reopen = now + sn->backoff * 1000;
+}
+
+/* each failed attempt doubles the wait for the next one */
+void reopen_device (struct sensor *sn, int64_t now) {
+  sn->reopen = 0;
+  if ((sn->fd = open (sn->device, O_RDONLY | O_NDELAY)) != -1 && set_tty (sn, &conf) == 0) {
+    syslog (LOG_INFO, "%s: reopened %s", sn->tag, sn->device);
+    return;
+  }
+  if (sn->fd != -1)
+    close (sn->fd);
+  sn->fd = -1;
+  sn->backoff = (sn->backoff * 2 < REOPEN_MAX) ? sn->backoff * 2 : REOPEN_MAX;
+  sn->reopen = now + sn->backoff * 1000;
+}
+
+/*
+ * Read what the tty of sensor n has and queue the datagrams in it. With
+ * -X frame poll () only wakes up at MS_DGRAMLEN waiting bytes; once the
+ * reads are out of step with the datagrams (a byte of noise or one lost)
+ * the rest of a datagram never wakes it, so it is fetched here while the
+ * framer holds a partial one (see reader_tick ()).
+ */
+void read_tty (struct sensor *sn, int n) {
+  char buf[LINELEN];
+  struct q_entry e;
+  struct stamp ts;
+  int64_t step;
+  int len;
+
+  if ((len = framer_fill (&sn->framer, sn->fd)) == -1 && (errno == EAGAIN || errno == EINTR))
+    return;
+  ts_stamp (&ts);                                               // right after the read
+  if (len <= 0) {                                               // hangup, EOF or EIO
+    device_failed (sn, ts_ns (&ts.mono) / 1000000, len ? strerror (errno) : "end of file");
+    return;
+  }
+  sn->lastbyte = ts_ns (&ts.mono) / 1000000;
+  if ((step = ts_discipline (&ts)))
+    syslog (LOG_WARNING, "clock stepped by %+.3f s", step / 1e9);
+  sn->stats->reads++;
+  sn->stats->bytes += len;
+  while ((len = framer_next (&sn->framer, buf, LINELEN)) > 0) {	// one datagram per pass
+    if (read_frame (&e, n, buf, len, &ts) == 0)
+      sn->backoff = REOPEN_MIN;
+    if (queue_push (&queue, &e) == -1) {
+      __atomic_store_n (&sn->dropped, sn->dropped + 1, __ATOMIC_RELAXED);
+      sn->stats->dropped++;
+    }
+  }
+  sn->stats->resyncs = sn->framer.resyncs;
+}
+
+/*
+ * What the reader does by the clock: drop partial datagrams after
+ * FRAME_GAP ms of silence, with -X frame look for the rest of a partial
+ * one every FRAME_DRAIN ms, and retry failed ttys. Returns how long
+ * poll () may wait; at most a second, which bounds how late a signal
+ * right before poll () is seen.
+ */
+int reader_tick (void) {
+  struct timespec mono;
+  struct sensor *sn;
+  int64_t now, wait = 1000, left;
+  int i;
+
+  clock_gettime (CLOCK_MONOTONIC, &mono);
+  now = ts_ns (&mono) / 1000000;
+  for (i = 0; i < nsensor; i++) {
+    sn = &sensor[i];
+    if (!sn->device[0])
+      continue;
+    if (sn->fd == -1 && sn->reopen && now >= sn->reopen)
+      reopen_device (sn, now);
+    if (sn->fd == -1 && sn->reopen)
+      left = sn->reopen - now;
+    else if (sn->fd != -1 && framer_pending (&sn->framer)) {
+      if ((left = sn->lastbyte + FRAME_GAP - now) <= 0) {
+        framer_discard (&sn->framer);
+        sn->stats->partials = sn->framer.partials;
+        continue;
+      }
+      if (conf.rxmode == CONF_RX_FRAME && left > FRAME_DRAIN)
+        left = FRAME_DRAIN;                                     // read the rest ourselves
+    } else
+      continue;
+    if (left < wait)
+      wait = (left > 0) ? left : 0;
+  }
+  return wait;
+}
+
+/*
+ * Settings from the config file and then the command line, which wins.
+ * Options that only make sense at startup (-C, -r, -x, -V) are skipped.
+ */
+int read_conf (struct conf *cf, int argc, char **argv, char *err, int errsize) {
+  int c;
+
+  conf_init (cf);
+  if (conffile && conf_load (cf, conffile, err, errsize) == -1)
+    return -1;
+  optind = 1;
+  while ((c = getopt (argc, argv, OPTIONS)) != -1) {
+    if (strchr ("CrxV", c))
+      continue;
+    if (c == '?' || conf_set (cf, c, optarg) == -1) {
+      snprintf (err, errsize, "invalid option -%c %s", c, optarg ? optarg : "");
+      return -1;
+    }
+  } /* while getopt */
+  if (cf->ndevice == 0)
+    strcpy (cf->device[cf->ndevice++], DEFTTY);
+  return 0;
+}
+
+/* same list of strings in both configurations */
+#define SAMELIST(_A_, _B_, _N_, _L_) \
+  ((_B_) && (_A_)->_N_ == (_B_)->_N_ && memcmp ((_A_)->_L_, (_B_)->_L_, sizeof ((_A_)->_L_[0]) * (_A_)->_N_) == 0)
+
+/* the tty name of a sensor and the tag of its messages */
+void sensor_name (struct sensor *sn) {
+  char *s;
+
+  sn->tty = ((s = strrchr (sn->device, '/'))) ? s + 1 : sn->device;
+  if (conf.ndevice > 1)
+    snprintf (sn->tag, sizeof (sn->tag), "ELTAKO-MS[%.28s]", sn->tty);
+  else
+    strcpy (sn->tag, "ELTAKO-MS");
+}
+
+/*
+ * Bring the outputs of a sensor in line with conf. old is the previous
+ * configuration, NULL for a new sensor. Outputs that did not change are
+ * left alone, so the current interval, rollup windows and alarm states
+ * carry on.
+ */
+void sensor_setup (struct sensor *sn, const struct conf *old) {
+  char file[CONF_PATHLEN + 40];
+  char shmf[CONF_PATHLEN + 40];
+  int j;
+
+  sensor_name (sn);
+  if (conf.logfile[0])
+    devpath (file, sizeof (file), conf.logfile, sn->tty);
+  else
+    snprintf (file, sizeof (file), "%s/%.15s-%.16s.log", conf.logdir, program, sn->tty);
+  if (!use_syslog && (old == NULL || strcmp (file, sn->logf))) {
+    log_close (&sn->logfile);
+    strcpy (sn->logf, file);
+    if (log_open (&sn->logfile, sn->logf, conf.flush_n, conf.flush_t) == -1)
+      syslog (LOG_ERR, "cannot open %s for logging", sn->logf);
+  }
+  sn->logfile.flush_n = conf.flush_n;
+  sn->logfile.flush_t = conf.flush_t;
+
+  file[0] = '\0';
+  if (conf.binlog[0])
+    devpath (file, sizeof (file), conf.binlog, sn->tty);
+  if (old == NULL || strcmp (file, sn->binlogf)) {
+    binlog_close (&sn->binlog);
+    strcpy (sn->binlogf, file);
+    if (file[0] && binlog_open (&sn->binlog, file) == -1)
+      syslog (LOG_ERR, "cannot open %s for logging", file);
+  }
+
+  file[0] = '\0';
+  if (conf.samplelog[0])
+    devpath (file, sizeof (file), conf.samplelog, sn->tty);
+  if (old == NULL || strcmp (file, sn->samplelogf)) {
+    samplelog_close (&sn->samplelog);
+    strcpy (sn->samplelogf, file);
+    if (file[0] && samplelog_open (&sn->samplelog, file, conf.decimate, conf.flush_t) == -1)
+      syslog (LOG_ERR, "cannot open %s for logging", file);
+  }
+  sn->samplelog.every = conf.decimate;
+  sn->samplelog.lf.flush_t = conf.flush_t ? conf.flush_t : SLOG_FLUSH;
+
+  snprintf (shmf, sizeof (shmf), "%s/%.15s-%.16s", conf.shmdir, program, sn->tty);
+  if (old == NULL || strcmp (shmf, sn->status.path) || conf.shmmode != sn->status.mode) {
+    status_close (&sn->status);
+    if (status_open (&sn->status, shmf, conf.shmmode) == -1)
+      syslog (LOG_ERR, "cannot map %s", shmf);
+  }
+  file[0] = '\0';
+  if (conf.history)
+    snprintf (file, sizeof (file), "%.190s.hist", shmf);
+  if (old == NULL || strcmp (file, sn->history.path)) {
+    history_close (&sn->history);
+    if (file[0] && history_open (&sn->history, file) == -1)
+      syslog (LOG_ERR, "cannot map %s", file);
+  }
+
+  /* rollup windows restart only if their list changed */
+  if (!SAMELIST (&conf, old, nrollup, rollup_rrd) || !SAMELIST (&conf, old, nrollup, rollup_period) ||
+      conf.ndevice != old->ndevice || strcmp (conf.rrdcached, old->rrdcached)) {
+    rollup_close (&sn->rollup);
+    rollup_init (&sn->rollup, conf.rrdcached);
+    for (j = 0; j < conf.nrollup; j++) {
+      devpath (file, sizeof (file), conf.rollup_rrd[j], sn->tty);
+      rollup_add (&sn->rollup, conf.rollup_period[j], file);
+    }
+  }
+
+  /* alarm rules keep their state if they are still in the same place */
+  sn->rules.n = 0;
+  for (j = 0; j < nrule; j++) {
+    rules_add (&sn->rules, &rule[j]);
+    if (old == NULL || j >= old->nrule || strcmp (conf.rule[j], old->rule[j])) {
+      sn->rules.count[j] = 0;
+      sn->rules.active &= ~(1u << j);
+    }
+  }
+  sn->rules.active &= (nrule < 32) ? (1u << nrule) - 1 : ~0u;
+
+  /* a new interval starts with the next window */
+  if (old == NULL)
+    agg_init (&sn->agg, conf.interval, ts_now ());
+  else
+    agg_interval (&sn->agg, conf.interval);
+}
+
+/* pick up the windows a daemon before us left in the checkpoint; not for replays */
+void sensor_resume (struct sensor *sn) {
+  char file[CONF_PATHLEN + 40];
+  int n;
+
+  snprintf (file, sizeof (file), "%s/%.15s-%.16s.state", conf.shmdir, program, sn->tty);
+  if (ckpt_open (&sn->ckpt, file) == -1)
+    syslog (LOG_ERR, "cannot map %s", file);
+  else if ((n = ckpt_restore (&sn->ckpt, &sn->agg, &sn->rollup, ts_now ())))
+    syslog (LOG_INFO, "%s: resumed %d windows from %s", sn->tag, n, file);
+}
+
+/* the capture of the raw bytes; not used for replays */
+void sensor_capture (struct sensor *sn) {
+  char file[CONF_PATHLEN + 40] = "";
+
+  if (conf.capture[0])
+    devpath (file, sizeof (file), conf.capture, sn->tty);
+  if (strcmp (file, sn->capturef) == 0)
+    return;
+  if (sn->framer.tee != -1)
+    close (sn->framer.tee);
+  strcpy (sn->capturef, file);
+  if (file[0] && (sn->framer.tee = open (file, O_WRONLY | O_CREAT | O_APPEND, 0644)) == -1)
+    syslog (LOG_ERR, "cannot open %s for capturing", file);
+}
+
+/*
+ * Switch to the configuration in nc. Rules and sinks are checked first,
+ * nothing is changed if one of them is invalid. Devices that are still
+ * configured stay open; new ones get a free slot, removed ones are
+ * closed. The writer thread must not be running.
+ */
+int apply_conf (const struct conf *nc, struct conf *old, int replaying) {
+  struct rule nrules[RULES_MAX];
+  struct sink nsinks[SINK_MAX];
+  struct msglog nlog;
+  struct deadband ndb;
+  struct sensor *sn;
+  int i, j, n;
+
+  for (i = 0; i < nc->nrule; i++)
+    if (rule_parse (&nrules[i], nc->rule[i]) == -1) {
+      syslog (LOG_ERR, "invalid rule %s", nc->rule[i]);
+      fprintf (stderr, "invalid rule %s\n", nc->rule[i]);
+      while (i--)
+        rule_free (&nrules[i]);
+      return -1;
+    }
+  if (deadband_parse (&ndb, nc->deadband, nc->heartbeat) == -1) {
+    syslog (LOG_ERR, "invalid deadband %s", nc->deadband);
+    fprintf (stderr, "invalid deadband %s\n", nc->deadband);
+    for (i = 0; i < nc->nrule; i++)
+      rule_free (&nrules[i]);
+    return -1;
+  }
+  for (j = 0; j < nc->nsink; j++)
+    if (sink_open (&nsinks[j], nc->sink[j]) == -1) {
+      syslog (LOG_ERR, "invalid sink %s", nc->sink[j]);
+      fprintf (stderr, "invalid sink %s\n", nc->sink[j]);
+      while (j--)
+        sink_close (&nsinks[j]);
+      for (i = 0; i < nc->nrule; i++)
+        rule_free (&nrules[i]);
+      return -1;
+    }
+  if (msglog_open (&nlog, nc->syslogd, program, nc->rfc5424) == -1) {
+    syslog (LOG_ERR, "invalid syslogd %s", nc->syslogd);
+    fprintf (stderr, "invalid syslogd %s\n", nc->syslogd);
+    for (j = 0; j < nc->nsink; j++)
+      sink_close (&nsinks[j]);
+    for (i = 0; i < nc->nrule; i++)
+      rule_free (&nrules[i]);
+    return -1;
+  }
+
+  if (old)
+    *old = conf;
+  conf = *nc;
+
+  for (i = 0; i < nsink; i++)
+    sink_close (&sink[i]);
+  memcpy (sink, nsinks, sizeof (nsinks[0]) * conf.nsink);
+  nsink = conf.nsink;
+  memset (stats->sink, 0, sizeof (stats->sink));
+  for (i = 0; i < nsink; i++) {
+    sink[i].stats = &stats->sink[i];
+    snprintf (stats->sink[i].name, sizeof (stats->sink[i].name), "%s", sink[i].spec);
+  }
+  msglog_close (&wlog);
+  wlog = nlog;
+  wlog.stats = &stats->log;
+  for (i = 0; i < nrule; i++)
+    rule_free (&rule[i]);
+  memcpy (rule, nrules, sizeof (nrules[0]) * conf.nrule);
+  nrule = conf.nrule;
+  deadband = ndb;
+  for (i = 0; i < nsensor; i++)
+    sensor[i].published.have = 0;                              // publish the next one in any case
+
+  /* devices no longer configured */
+  for (i = 0; i < nsensor; i++) {
+    sn = &sensor[i];
+    for (j = 0; sn->device[0] && j < conf.ndevice; j++)
+      if (strcmp (sn->device, conf.device[j]) == 0)
+        break;
+    if (sn->device[0] && j == conf.ndevice) {
+      syslog (LOG_INFO, "%s: removed", sn->tag);
+      sensor_close (sn);
+    }
+  }
+
+  for (j = 0; j < conf.ndevice; j++) {
+    for (i = 0; i < nsensor; i++)
+      if (strcmp (sensor[i].device, conf.device[j]) == 0)
+        break;
+    if (i < nsensor) {                                          // still there
+      sn = &sensor[i];
+      sensor_setup (sn, old);
+      if (!replaying && sn->fd != -1 && old && (conf.baud != old->baud || conf.rxmode != old->rxmode ||
+                                               conf.lowlatency != old->lowlatency || conf.rtscts != old->rtscts))
+        set_tty (sn, &conf);
+      if (!replaying)
+        sensor_capture (sn);
+      continue;
+    }
+
+    for (n = 0; n < nsensor && sensor[n].device[0]; n++)
+      ;
+    if (n == CONF_MAXDEV)
+      break;
+    sn = &sensor[n];
+    memset (sn, 0, sizeof (*sn));
+    sn->fd = sn->framer.tee = -1;
+    sn->binlog.fd = sn->binlog.idxfd = -1;
+    sn->backoff = REOPEN_MIN;
+    sn->lastgood = ts_now ();
+    strcpy (sn->device, conf.device[j]);
+    sensor_name (sn);
+    if (!replaying && lock_device (sn) == -1) {                 // before the files of a daemon that has it
+      sn->device[0] = '\0';
+      if (old == NULL)
+        cleanup (2);
+      continue;
+    }
+    framer_init (&sn->framer);
+    sensor_setup (sn, NULL);
+    sn->stats = &stats->sensor[n];
+    memset (sn->stats, 0, sizeof (*sn->stats));
+    snprintf (sn->stats->tty, sizeof (sn->stats->tty), "%s", sn->tty);
+    if (n == nsensor)
+      nsensor++;
+    if (replaying)
+      continue;
+    sensor_resume (sn);
+    if (open_device (sn) == -1) {
+      if (old == NULL)
+        cleanup (1);
+      sensor_close (sn);
+      continue;
+    }
+    sensor_capture (sn);
+  }
+  return 0;
+}
+
+/* move the counters to the shared stats block and point everyone there */
+void share_stats (const char *path) {
+  int i;
+
+  stats = stats_share (path, stats);
+  for (i = 0; i < nsensor; i++)
+    sensor[i].stats = &stats->sensor[i];
+  for (i = 0; i < nsink; i++)
+    sink[i].stats = &stats->sink[i];
+  wlog.stats = &stats->log;
+}
+
+/* the writer gets no signals, they interrupt the reader's poll() */
+void start_writer (pthread_t *wthread) {
+  sigset_t sigs, oldsigs;
+
+  sigfillset (&sigs);
+  pthread_sigmask (SIG_BLOCK, &sigs, &oldsigs);
+  if ((errno = pthread_create (wthread, NULL, writer, NULL)) != 0) {
+    perror ("pthread_create");
+    syslog (LOG_ERR, "cannot start writer thread");
+    cleanup (1);
+  }
+  pthread_sigmask (SIG_SETMASK, &oldsigs, NULL);
+}
+
+/* let the writer finish what is queued and stop */
+void stop_writer (pthread_t *wthread) {
+  queue_close (&queue);
+  pthread_join (*wthread, NULL);
+  queue_reopen (&queue);
+}
+
+/* the metrics endpoint; its thread runs until the daemon exits */
+void *metrics (void *arg) {
+  stats_serve ((int)(intptr_t)arg, stats);
+  return NULL;
+}
+
+void start_metrics (int port) {
+  sigset_t sigs, oldsigs;
+  pthread_t mthread;
+  int fd;
+
+  if ((fd = stats_listen (port)) == -1) {
+    syslog (LOG_ERR, "cannot listen on port %d for metrics", port);
+    return;
+  }
+  sigfillset (&sigs);
+  pthread_sigmask (SIG_BLOCK, &sigs, &oldsigs);
+  if (pthread_create (&mthread, NULL, metrics, (void *)(intptr_t)fd) == 0)
+    pthread_detach (mthread);
+  else
+    syslog (LOG_ERR, "cannot start metrics thread");
+  pthread_sigmask (SIG_SETMASK, &oldsigs, NULL);
+}
+
+/* the fds to poll and the sensors they belong to */
+int poll_list (struct pollfd *pfd, int *slot) {
+  int i, n = 0;
+
+  for (i = 0; i < nsensor; i++)
+    if (sensor[i].device[0] && sensor[i].fd != -1) {
+      pfd[n].fd = sensor[i].fd;
+      pfd[n].events = POLLIN;
+      slot[n++] = i;
+    }
+  return n;
+}
+
+void copyright (char *prog) {
+  printf ("%s ver %s\n", prog, VERSION);
+  printf ("Copyright (c) 2008 Frank Sautter; (c) 1996 Harald Milz\n");
+  exit (0);
+}
+
+
+int main (int argc, char **argv) {
+  char err[200];
+  char replayf[LINELEN] = "";
+  char statsf[CONF_PATHLEN + 40];
+  struct conf nc, old;
+  int rate = 0;
+  struct pollfd pfd[CONF_MAXDEV];
+  int slot[CONF_MAXDEV];
+  int npfd;
+  struct sensor *sn;
+  int i;
+  int c;
+  char *s;
+  pthread_t wthread;
+
+  /* remove the dirpath from the program name */
+  program = argv[0];
+  if ((s = strrchr (program, '/')))
+    program = ++s;
+
+  while ((c = getopt (argc, argv, OPTIONS)) != -1) {
+    switch (c) {
+      case 'V':
+        copyright(program);
+        break;
+      case 'C':
+        conffile = optarg;
+        break;
+      case 'r':
+        strcpy (replayf, optarg);
+        break;
+      case 'x':
+        rate = atoi(optarg);
+        break;
+      case '?':
+        usage (program);
+        exit (1);
+        break;
+    } /* switch () */
+  } /* while getopt */
+
+  if (read_conf (&nc, argc, argv, err, sizeof (err)) == -1) {
+    printf ("%s.\n", err);
+    exit (1);
+  }
+  if (replayf[0]) {
+    snprintf (nc.device[0], sizeof (nc.device[0]), "%s", replayf);
+    nc.ndevice = 1;
+  }
+  use_syslog = nc.use_syslog;
+
+  if (use_syslog)
+    openlog (program, LOG_PID, LOG_LOCAL5);
+
+  snprintf (statsf, sizeof (statsf), "%s/%.15s.stats", nc.shmdir, program);
+  stats = stats_open (NULL);                                    // until the devices are ours
+  wlog.fd = -1;
+  ts_init ();
+  if (apply_conf (&nc, NULL, replayf[0] != '\0') == -1)
+    exit (1);
+  if (replayf[0] == '\0')
+    share_stats (statsf);
+  for (i = 0; !use_syslog && i < nsensor; i++)
+    if (sensor[i].logfile.fp == NULL) {
+      fprintf (stderr, "cannot open %s for logging\n", sensor[i].logf);
+      cleanup (1);
+    }
+
+  if (replayf[0]) {
+    c = replay (&sensor[0], replayf, rate);
+    log_close (&sensor[0].logfile);
+    rollup_close (&sensor[0].rollup);
+    binlog_close (&sensor[0].binlog);
+    samplelog_close (&sensor[0].samplelog);
+    for (i = 0; i < nsink; i++)
+      sink_close (&sink[i]);
+    exit (c);
   }
 
   signal (SIGTERM, closefiles);
-  signal (SIGHUP, closefiles);
+  signal (SIGHUP, reopenfiles);
   signal (SIGINT, closefiles);
   signal (SIGQUIT, closefiles);
+  signal (SIGUSR1, flushfiles);
+  signal (SIGPIPE, SIG_IGN);
 
-  /* endless loop */
-
-  count = maxRain = maxWind = accDawn = maxObsc = accSunE = accSunW = accSunS = accTemp = 0;
-  oldEpoch = -1;
-  while (1) {
-    FD_ZERO (&fds);
-    FD_SET (fd, &fds);
-		
-    select (FD_SETSIZE, &fds, NULL, NULL, NULL);
-    if (FD_ISSET (fd, &fds)) {
-      s = buf;
-      err = 0;
-      do {
-        read (fd, s++, 1);
-      } while (*(s-1) != 0x03 && (s-buf) < LINELEN );			// end marking read?
-
-      *(s) = '\0';							// terminate string
-      strncpy(bufcpy,buf,LINELEN-1);
-
-      /* sanity checks */
-
-      if ( (s - buf) != 40 )                      err |= 0x0001;	// incorrect length
-      if ( *(buf)    != 'W')                      err |= 0x0002;	// no 'W' on 1
-      if ( *(buf+ 1) != '+' && *(buf+ 1) != '-' ) err |= 0x0004;	// no '+' or '-' on pos 2
-
-      if ( *(buf+ 2) <  '0' || *(buf+ 2) >  '9' ) err |= 0x0008;	// no numeric on pos 3
-      if ( *(buf+ 3) <  '0' || *(buf+ 3) >  '9' ) err |= 0x0008;	// no numeric on pos 4
-      if ( *(buf+ 4) != '.' )                     err |= 0x0008;	// no '.' on pos 5
-      if ( *(buf+ 5) <  '0' || *(buf+ 5) >  '9' ) err |= 0x0008;	// no numeric on pos 6
-
-      if ( *(buf+ 6) <  '0' || *(buf+ 6) >  '9' ) err |= 0x0010;	// no numeric on pos 7
-      if ( *(buf+ 7) <  '0' || *(buf+ 7) >  '9' ) err |= 0x0010;	// no numeric on pos 8
-
-      if ( *(buf+ 8) <  '0' || *(buf+ 8) >  '9' ) err |= 0x0020;	// no numeric on pos 9
-      if ( *(buf+ 9) <  '0' || *(buf+ 9) >  '9' ) err |= 0x0020;	// no numeric on pos 10
-
-      if ( *(buf+10) <  '0' || *(buf+10) >  '9' ) err |= 0x0040;	// no numeric on pos 11
-      if ( *(buf+11) <  '0' || *(buf+11) >  '9' ) err |= 0x0040;	// no numeric on pos 12
-
-      if ( *(buf+12) != 'J' && *(buf+12) != 'N' ) err |= 0x0080;	// no 'J' or 'N' on pos 13
-
-      if ( *(buf+13) <  '0' || *(buf+13) >  '9' ) err |= 0x0100;	// no numeric on pos 14
-      if ( *(buf+14) <  '0' || *(buf+14) >  '9' ) err |= 0x0100;	// no numeric on pos 15
-      if ( *(buf+15) <  '0' || *(buf+15) >  '9' ) err |= 0x0100;	// no numeric on pos 16
-
-      if ( *(buf+16) <  '0' || *(buf+16) >  '9' ) err |= 0x0200;	// no numeric on pos 17
-      if ( *(buf+17) <  '0' || *(buf+17) >  '9' ) err |= 0x0200;	// no numeric on pos 18
-      if ( *(buf+18) != '.' )                     err |= 0x0200;	// no '.' on pos 19
-      if ( *(buf+19) <  '0' || *(buf+19) >  '9' ) err |= 0x0200;	// no numeric on pos 20
-
-      if ( *(buf+20) != 'J' && *(buf+20) != 'N' ) err |= 0x0400;	// no 'J' or 'N' on pos 21
-
-      if ( *(buf+21) != '?' )                     err |= 0x0800;	// no '?' on pos 22
-      if ( *(buf+22) != '1' )                     err |= 0x0800;	// no '1' on pos 23
-      if ( *(buf+23) != '5' )                     err |= 0x0800;	// no '5' on pos 24
-      if ( *(buf+24) != '1' )                     err |= 0x0800;	// no '1' on pos 25
-      if ( *(buf+25) != '5' )                     err |= 0x0800;	// no '5' on pos 26
-      if ( *(buf+26) != '1' )                     err |= 0x0800;	// no '1' on pos 27
-      if ( *(buf+27) != '5' )                     err |= 0x0800;	// no '5' on pos 28
-      if ( *(buf+28) != '1' )                     err |= 0x0800;	// no '1' on pos 29
-      if ( *(buf+29) != '5' )                     err |= 0x0800;	// no '5' on pos 30
-      if ( *(buf+30) != '1' )                     err |= 0x0800;	// no '1' on pos 31
-      if ( *(buf+31) != '5' )                     err |= 0x0800;	// no '5' on pos 32
-      if ( *(buf+32) != '1' )                     err |= 0x0800;	// no '1' on pos 33
-      if ( *(buf+33) != '5' )                     err |= 0x0800;	// no '5' on pos 34
-      if ( *(buf+34) != '?' )                     err |= 0x0800;	// no '?' on pos 35
-
-      if ( *(buf+35) <  '0' || *(buf+35) >  '9' ) err |= 0x1000;	// no numeric on pos 36
-      if ( *(buf+36) <  '0' || *(buf+36) >  '9' ) err |= 0x1000;	// no numeric on pos 37
-      if ( *(buf+37) <  '0' || *(buf+37) >  '9' ) err |= 0x1000;	// no numeric on pos 38
-      if ( *(buf+38) <  '0' || *(buf+38) >  '9' ) err |= 0x1000;	// no numeric on pos 39
-
-      for (i=0, sum=0; i<35; i++) sum += *(buf+i);
-      if ((err & 0x1000) || sum != atoi(buf+35))  err |= 0x2000;	// errorneous checksum 
-
-      ltime = time(NULL);						// get current calendar time
-
-      if (err == 0) {
-	rain = (*(buf+20) == 'J') ? 'R' : 'r';
-        maxRain = (rain > maxRain) ? rain : maxRain;
-        *(buf+20) = '\0';
-        wind = (int)(atof(buf+16)*10);
-        maxWind = (wind > maxWind) ? wind : maxWind;
-        *(buf+16) = '\0';
-        dawn = atoi(buf+13);
-        accDawn += dawn;
-        obsc = (*(buf+12) == 'J') ? 'O' : 'o';
-        maxObsc = (obsc > maxObsc) ? obsc : maxObsc;
-        *(buf+12) = '\0';
-        sunE = atoi(buf+10);
-        accSunE += sunE;
-        *(buf+10) = '\0';
-        sunW = atoi(buf+8);
-        accSunW += sunW;
-        *(buf+8) = '\0';
-        sunS = atoi(buf+6);
-        accSunS += sunS;
-        *(buf+6) = '\0';
-        temp = (int)(atof(buf+1)*10);
-        accTemp += temp;
-	count++;
-
-        shmfile = fopen (shmf, "w");
-        fprintf (shmfile, "t%+05.1fs%2.2dw%2.2de%2.2d%cd%3.3dv%04.1f%c\n"
-                          "Temperature : %+.1f\n"
-                          "Sun South   : %d\n"
-                          "Sun West    : %d\n"
-                          "Sun East    : %d\n"
-                          "Obscure     : %c\n"
-                          "Dawn        : %d\n"
-                          "Wind        : %.1f\n"
-                          "Rain        : %c\n", 
-                 (float)temp/10, sunS, sunW, sunE, obsc, dawn, (float)wind/10, rain,
-                 (float)temp/10, sunS, sunW, sunE, obsc, dawn, (float)wind/10, rain);
-        fclose (shmfile);
-        
-	
-        if (ltime % interval < oldEpoch) {
-	  epoch = (ltime % interval <= interval * .05 ) ? (time_t)((long)(ltime/interval)*interval) : ltime;
-          strftime(datestr,80,"%F %H:%M:%S",localtime(&epoch));
-          avgDawn = (int)(accDawn / count + .5);
-          avgSunE = (int)(accSunE / count + .5);
-          avgSunW = (int)(accSunW / count + .5);
-          avgSunS = (int)(accSunS / count + .5);
-          avgTemp = (int)(accTemp / count + .5);
-          if (use_syslog) {
-            syslog (LOG_INFO, "ELTAKO-MS: t%+05.1fs%2.2dw%2.2de%2.2d%cd%3.3dv%04.1f%c", (float)avgTemp/10, avgSunS, avgSunW, avgSunE, maxObsc, avgDawn, (float)maxWind/10, maxRain);
-          } else {
-//debug     printf ("%s t%+05.1fs%2.2dw%2.2de%2.2d%cd%3.3dv%04.1f%c %04x %s\n", datestr, (float)avgTemp/10, avgSunS, avgSunW, avgSunE, maxObsc, avgDawn, (float)maxWind/10, maxRain, err, bufcpy);
-            logfile = fopen (logf, "a");
-            fprintf (logfile, "%s t%+05.1fs%2.2dw%2.2de%2.2d%cd%3.3dv%04.1f%c\n", datestr, (float)avgTemp/10, avgSunS, avgSunW, avgSunE, maxObsc, avgDawn, (float)maxWind/10, maxRain);
-            fclose (logfile);
-          } /* if (use_syslog) */
-          count = maxRain = maxWind = accDawn = maxObsc = accSunE = accSunW = accSunS = accTemp = 0;
-        } /* if (ltime .. */
-        oldEpoch = ltime % interval;
-      } else {
-        syslog (LOG_INFO, "ELTAKO-MS: Error 0x%04x reading sensordata: %s", err, bufcpy);
-      } /* if (err ...) */
-    } /* if (FD_ISSET ...) */
-  } /* while (1) */
-  /* NEVER REACHED */
-} /* main () */
+  if (queue_init (&queue) == -1) {
+    perror ("pipe");
+    cleanup (1);
+  }
+  start_writer (&wthread);
+  if (conf.prometheus)
+    start_metrics (conf.prometheus);
 
+  /* read until a signal tells us to stop */
+
+  while (!got_term) {
+    if (got_sighup) {
+      /*
+       * Reload the config and the time zone and reopen the logs
+       * (logrotate). The ttys stay open; what arrives meanwhile waits
+       * in the kernel buffer.
+       */
+      got_sighup = 0;
+      stop_writer (&wthread);
+      ts_tzchanged ();
+      if (read_conf (&nc, argc, argv, err, sizeof (err)) == -1)
+        syslog (LOG_ERR, "reload failed: %s", err);
+      else if (apply_conf (&nc, &old, 0) == 0)
+        syslog (LOG_INFO, "reloaded %s", conffile ? conffile : "settings");
+      for (i = 0; !use_syslog && i < nsensor; i++)
+        if (sensor[i].device[0] && log_reopen (&sensor[i].logfile) == -1)
+          syslog (LOG_ERR, "cannot reopen %s", sensor[i].logf);
+      for (i = 0; i < nsensor; i++)
+        if (sensor[i].device[0] && sensor[i].samplelogf[0] && samplelog_reopen (&sensor[i].samplelog) == -1)
+          syslog (LOG_ERR, "cannot reopen %s", sensor[i].samplelogf);
+      start_writer (&wthread);
+    }
+    if (got_sigusr1)
+      queue_wake (&queue);
 
+    npfd = poll_list (pfd, slot);
+    if (poll (pfd, npfd, reader_tick ()) == -1)
+      continue;
+
+    for (i = 0; i < npfd; i++) {
+      sn = &sensor[slot[i]];
+      if (pfd[i].revents || (conf.rxmode == CONF_RX_FRAME && framer_pending (&sn->framer)))
+        read_tty (sn, slot[i]);
+    }
+    queue_wake (&queue);
+  } /* while (!got_term) */
+
+  queue_close (&queue);
+  pthread_join (wthread, NULL);
+  cleanup (0);
+  return 0;
+} /* main () */
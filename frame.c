@@ -0,0 +1,135 @@
+/*
+ * frame.c - datagram framing for the eltakoMS serial reader
+ *
+ * This software is copyright 2008 by Frank Sautter
+ * (eltakoms~at~sautter~dot~com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ */
+
+#include <unistd.h>
+#include <string.h>
+#include <sys/uio.h>
+#include "frame.h"
+
+#define RINGMASK (FRAME_RINGSIZE - 1)
+
+/* f->tee is left alone, it is set up by the caller */
+void framer_init (struct framer *f) {
+  f->head = f->tail = f->scan = 0;
+  f->resync = 0;
+  f->resyncs = f->partials = 0;
+}
+
+/* read whatever is available from fd into the free part of the ring */
+ssize_t framer_fill (struct framer *f, int fd) {
+  struct iovec iov[2];
+  unsigned int used = f->head - f->tail;
+  unsigned int pos = f->head & RINGMASK;
+  unsigned int room = FRAME_RINGSIZE - used;
+  int cnt = 1;
+  ssize_t n;
+
+  if (room == 0)
+    return 0;
+
+  iov[0].iov_base = f->ring + pos;
+  if (pos + room > FRAME_RINGSIZE) {                              // free space wraps
+    iov[0].iov_len = FRAME_RINGSIZE - pos;
+    iov[1].iov_base = f->ring;
+    iov[1].iov_len = room - iov[0].iov_len;
+    cnt = 2;
+  } else {
+    iov[0].iov_len = room;
+  }
+
+  if ((n = readv (fd, iov, cnt)) > 0) {
+    f->head += n;
+    if (f->tee != -1) {                                         // raw capture
+      if ((size_t)n <= iov[0].iov_len) {
+        iov[0].iov_len = n;
+        cnt = 1;
+      } else {
+        iov[1].iov_len = n - iov[0].iov_len;
+      }
+      if (writev (f->tee, iov, cnt) == -1) {
+        close (f->tee);
+        f->tee = -1;
+      }
+    }
+  }
+  return n;
+}
+
+/* copy len bytes starting at the current datagram into buf */
+static void framer_copy (struct framer *f, char *buf, unsigned int len) {
+  unsigned int pos = f->tail & RINGMASK;
+  unsigned int first = (pos + len > FRAME_RINGSIZE) ? FRAME_RINGSIZE - pos : len;
+
+  memcpy (buf, f->ring + pos, first);
+  memcpy (buf + first, f->ring, len - first);
+  buf[len] = '\0';
+  f->tail += len;
+  f->scan = f->tail;
+}
+
+/*
+ * Pull the next datagram out of the ring into buf (NUL terminated).
+ * Returns its length including the ETX, or 0 if no complete datagram is
+ * buffered yet. As with the old byte-by-byte loop a run of size-1 bytes
+ * without ETX is handed out as is (and will fail the length check); after
+ * such a run everything up to the next 'W' is dropped.
+ */
+int framer_next (struct framer *f, char *buf, int size) {
+  unsigned int max = size - 1;
+  unsigned int len;
+  unsigned char c;
+
+  while (f->resync && f->tail != f->head) {
+    c = f->ring[f->tail & RINGMASK];
+    if (c == FRAME_SYNC) {
+      f->resync = 0;
+    } else {
+      f->tail++;
+      if (c == FRAME_ETX)
+        f->resync = 0;
+    }
+  }
+  if (f->resync)
+    return 0;
+
+  if (f->scan - f->tail > f->head - f->tail)                     // scan fell behind tail
+    f->scan = f->tail;
+
+  for (; f->scan != f->head; f->scan++) {
+    if (f->ring[f->scan & RINGMASK] == FRAME_ETX) {
+      len = f->scan - f->tail + 1;
+      if (len > max)
+        break;
+      framer_copy (f, buf, len);
+      return len;
+    }
+  }
+
+  if (f->head - f->tail >= max) {                                // no ETX in sight
+    framer_copy (f, buf, max);
+    f->resync = 1;
+    f->resyncs++;
+    return max;
+  }
+  return 0;
+}
+
+/*
+ * Drop what is buffered, e.g. the start of a datagram whose rest never
+ * came (FRAME_GAP) or the bytes of a tty that failed.
+ */
+void framer_discard (struct framer *f) {
+  if (framer_pending (f))
+    f->partials++;
+  f->tail = f->scan = f->head;
+  f->resync = 0;
+}
@@ -0,0 +1,49 @@
+/*
+ * frame.h - datagram framing for the eltakoMS serial reader
+ *
+ * This software is copyright 2008 by Frank Sautter
+ * (eltakoms~at~sautter~dot~com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ */
+
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <sys/types.h>
+
+#define FRAME_ETX      0x03            /* end of datagram */
+#define FRAME_SYNC     'W'             /* first character of a datagram */
+#define FRAME_RINGSIZE 512             /* must be a power of two */
+#define FRAME_GAP      100             /* ms of silence that end a partial datagram */
+#define FRAME_DRAIN    5               /* ms between reads of a partial one when poll () cannot tell */
+#define LINELEN        150             /* datagram buffer for framer_next () */
+
+/*
+ * Bytes from the tty are collected in a ring buffer. Complete datagrams
+ * (everything up to and including the ETX) are pulled out of it one by
+ * one, so a single read() may deliver partial, one or several datagrams.
+ */
+struct framer {
+  unsigned char ring[FRAME_RINGSIZE];
+  unsigned int head;                   /* write position, free running */
+  unsigned int tail;                   /* start of the current datagram */
+  unsigned int scan;                   /* next byte to look at for ETX */
+  int resync;                          /* skip bytes up to the next 'W' */
+  unsigned int resyncs;                /* runs without ETX that had to be cut */
+  unsigned int partials;               /* partial datagrams dropped after a gap */
+  int tee;                             /* copy of all bytes read, -1 = none */
+};
+
+void framer_init (struct framer *f);
+ssize_t framer_fill (struct framer *f, int fd);
+int framer_next (struct framer *f, char *buf, int size);
+void framer_discard (struct framer *f);
+
+/* bytes of an incomplete datagram are waiting */
+#define framer_pending(_F_) ((_F_)->head != (_F_)->tail)
+
+#endif /* FRAME_H */
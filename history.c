@@ -0,0 +1,223 @@
+/*
+ * history.c - ring of the recent datagrams with sliding window extremes
+ *
+ * This software is copyright 2008 by Frank Sautter
+ * (eltakoms~at~sautter~dot~com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include "history.h"
+#include "timestamp.h"
+
+static const uint32_t hist_seconds[HIST_WINDOWS] = HIST_SECONDS;
+
+static int hist_value (const struct ms_history *h, int ch, uint32_t n) {
+  n %= HIST_LEN;
+  switch (ch) {
+    case HW_WIND:
+      return h->wind[n];
+    case HW_TEMP:
+      return h->temp[n];
+    default:
+      return h->dawn[n];
+  } /* switch () */
+}
+
+/* append sample n; values it beats can never be the extreme again */
+static void deque_push (struct hist_deque *d, const struct ms_history *h, int ch, uint32_t n, int max) {
+  int x = hist_value (h, ch, n), y;
+
+  while (d->last != d->first) {
+    y = hist_value (h, ch, d->n[(d->last - 1) % HIST_LEN]);
+    if (max ? y > x : y < x)
+      break;
+    d->last--;
+  }
+  d->n[d->last++ % HIST_LEN] = n;
+}
+
+static int deque_front (const struct hist_deque *d, const struct ms_history *h, int ch) {
+  return hist_value (h, ch, d->n[d->first % HIST_LEN]);
+}
+
+/* add sample n (already in the ring) to all windows */
+static void hist_push (struct history *hs, uint32_t n) {
+  struct ms_history *h = hs->h;
+  int w, ch;
+
+  for (w = 0; w < HIST_WINDOWS; w++) {
+    for (ch = 0; ch < HW_COUNT; ch++) {
+      deque_push (&hs->st->min[w][ch], h, ch, n, 0);
+      deque_push (&hs->st->max[w][ch], h, ch, n, 1);
+    }
+    h->win[w].rain += (h->flags[n % HIST_LEN] & MS_RAIN) != 0;
+    h->win[w].obsc += (h->flags[n % HIST_LEN] & MS_OBSC) != 0;
+  }
+}
+
+/* take the oldest sample out of window w */
+static void hist_evict (struct history *hs, int w) {
+  struct ms_history *h = hs->h;
+  struct hist_deque *d;
+  uint32_t n = hs->st->tail[w]++;
+  int ch;
+
+  for (ch = 0; ch < HW_COUNT; ch++) {
+    d = &hs->st->min[w][ch];
+    if (d->first != d->last && d->n[d->first % HIST_LEN] == n)
+      d->first++;
+    d = &hs->st->max[w][ch];
+    if (d->first != d->last && d->n[d->first % HIST_LEN] == n)
+      d->first++;
+  }
+  h->win[w].rain -= (h->flags[n % HIST_LEN] & MS_RAIN) != 0;
+  h->win[w].obsc -= (h->flags[n % HIST_LEN] & MS_OBSC) != 0;
+}
+
+/* age out what is older than window w at now and publish it */
+static void hist_window (struct history *hs, int w, time_t now) {
+  struct ms_history *h = hs->h;
+  struct ms_hist_window *win = &h->win[w];
+  int ch;
+
+  while (hs->st->tail[w] != h->head &&
+         (time_t)h->time[hs->st->tail[w] % HIST_LEN] + (time_t)hist_seconds[w] <= now)
+    hist_evict (hs, w);
+
+  win->seconds = hist_seconds[w];
+  win->count = h->head - hs->st->tail[w];
+  for (ch = 0; ch < HW_COUNT; ch++) {
+    win->min[ch] = win->count ? deque_front (&hs->st->min[w][ch], h, ch) : 0;
+    win->max[ch] = win->count ? deque_front (&hs->st->max[w][ch], h, ch) : 0;
+  }
+}
+
+/*
+ * Map path. A ring an earlier daemon left there is kept and the deques
+ * are built again from it, so the windows survive a restart.
+ */
+int history_open (struct history *hs, const char *path) {
+  struct ms_history *h;
+  uint32_t n;
+  int fd, w;
+
+  memset (hs, 0, sizeof (*hs));
+  snprintf (hs->path, sizeof (hs->path), "%s", path);
+  if ((hs->st = calloc (1, sizeof (*hs->st))) == NULL ||
+      (fd = open (path, O_RDWR | O_CREAT, 0644)) == -1)
+    goto fail;
+  if (ftruncate (fd, sizeof (*h)) == -1) {
+    close (fd);
+    goto fail;
+  }
+  h = mmap (NULL, sizeof (*h), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close (fd);
+  if (h == MAP_FAILED)
+    goto fail;
+  if (h->magic != MS_HIST_MAGIC || h->version != MS_HIST_VERSION || h->len != HIST_LEN) {
+    memset (h, 0, sizeof (*h));
+    h->magic = MS_HIST_MAGIC;
+    h->version = MS_HIST_VERSION;
+    h->len = HIST_LEN;
+  }
+  hs->h = h;
+
+  n = (h->head > HIST_LEN) ? h->head - HIST_LEN : 0;
+  for (w = 0; w < HIST_WINDOWS; w++) {
+    hs->st->tail[w] = n;
+    h->win[w].rain = h->win[w].obsc = 0;
+  }
+  for (; n != h->head; n++)
+    hist_push (hs, n);
+  history_tick (hs, ts_now ());
+  return 0;
+
+fail:
+  free (hs->st);
+  hs->st = NULL;
+  hs->path[0] = '\0';
+  return -1;
+}
+
+void history_add (struct history *hs, const struct ms_sample *smp, time_t t) {
+  struct ms_history *h = hs->h;
+  uint32_t n, i;
+  int w;
+
+  if (h == NULL)
+    return;
+  n = h->head;
+  i = n % HIST_LEN;
+  h->seq++;                                                     // odd: update running
+  __sync_synchronize ();
+  for (w = 0; w < HIST_WINDOWS; w++)
+    while (hs->st->tail[w] + HIST_LEN <= n)                     // the slot is reused
+      hist_evict (hs, w);
+  h->time[i] = t;
+  h->temp[i] = smp->temp;
+  h->wind[i] = smp->wind;
+  h->dawn[i] = smp->dawn;
+  h->sunS[i] = smp->sunS;
+  h->sunW[i] = smp->sunW;
+  h->sunE[i] = smp->sunE;
+  h->flags[i] = smp->flags;
+  __sync_synchronize ();
+  h->head = n + 1;
+  hist_push (hs, n);
+  for (w = 0; w < HIST_WINDOWS; w++)
+    hist_window (hs, w, t);
+  __sync_synchronize ();
+  h->seq++;
+}
+
+/* let samples age out of the windows without new datagrams */
+void history_tick (struct history *hs, time_t now) {
+  struct ms_history *h = hs->h;
+  int w;
+
+  if (h == NULL)
+    return;
+  h->seq++;
+  __sync_synchronize ();
+  for (w = 0; w < HIST_WINDOWS; w++)
+    hist_window (hs, w, now);
+  __sync_synchronize ();
+  h->seq++;
+}
+
+/* when the oldest sample of a window ages out, 0 if all are empty */
+time_t history_deadline (const struct history *hs) {
+  const struct ms_history *h = hs->h;
+  time_t d = 0, t;
+  int w;
+
+  if (h == NULL)
+    return 0;
+  for (w = 0; w < HIST_WINDOWS; w++)
+    if (hs->st->tail[w] != h->head) {
+      t = (time_t)h->time[hs->st->tail[w] % HIST_LEN] + hist_seconds[w];
+      if (d == 0 || t < d)
+        d = t;
+    }
+  return d;
+}
+
+void history_close (struct history *hs) {
+  if (hs->h)
+    munmap (hs->h, sizeof (*hs->h));
+  free (hs->st);
+  hs->h = NULL;
+  hs->st = NULL;
+  hs->path[0] = '\0';
+}
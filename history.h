@@ -0,0 +1,129 @@
+/*
+ * history.h - ring of the recent datagrams with sliding window extremes
+ *
+ * This software is copyright 2008 by Frank Sautter
+ * (eltakoms~at~sautter~dot~com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ */
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdint.h>
+#include <time.h>
+#include "datagram.h"
+
+/*
+ * Mapped from <shmfile>.hist (-H). The last HIST_LEN datagrams are kept
+ * with one array per channel, sample n in slot n % HIST_LEN, so a reader
+ * looking at one channel walks a single dense array. Times are seconds
+ * on the steady clock of the daemon, which follows the wall clock (see
+ * timestamp.h).
+ *
+ * For the last minute, 10 minutes and hour the writer keeps the minimum
+ * and maximum of wind, temperature and dawn up to date with a monotonic
+ * deque per window and channel, so every datagram costs O(1) amortized
+ * and readers just copy win[] (see ms_history_window ()). A window also
+ * counts the datagrams that had rain or obscurity.
+ */
+#define MS_HIST_MAGIC   0x48534d45     /* "EMSH" */
+#define MS_HIST_VERSION 1
+#define HIST_LEN        4096           /* samples, power of two; over an hour of datagrams */
+#define HIST_WINDOWS    3
+#define HIST_SECONDS    { 60, 600, 3600 }
+
+enum { HW_WIND, HW_TEMP, HW_DAWN, HW_COUNT };   /* channels with extremes */
+
+struct ms_hist_window {
+  uint32_t seconds;                    /* length of the window */
+  uint32_t count;                      /* datagrams in it */
+  uint32_t rain;                       /* of them with MS_RAIN */
+  uint32_t obsc;                       /* of them with MS_OBSC */
+  int32_t min[HW_COUNT];               /* indexed by HW_*, 0 if count is 0 */
+  int32_t max[HW_COUNT];
+};
+
+struct ms_history {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t len;                        /* HIST_LEN */
+  volatile uint32_t seq;               /* odd while win[] changes, as in ms_status */
+  volatile uint32_t head;              /* datagrams so far, the newest is head - 1 */
+  struct ms_hist_window win[HIST_WINDOWS];
+  uint32_t time[HIST_LEN];
+  int16_t temp[HIST_LEN];
+  uint16_t wind[HIST_LEN];
+  uint16_t dawn[HIST_LEN];
+  uint8_t sunS[HIST_LEN];
+  uint8_t sunW[HIST_LEN];
+  uint8_t sunE[HIST_LEN];
+  uint8_t flags[HIST_LEN];
+};
+
+/* consistent copy of window w; for readers */
+static inline void ms_history_window (const struct ms_history *h, int w, struct ms_hist_window *copy) {
+  uint32_t seq;
+
+  do {
+    while ((seq = h->seq) & 1)
+      ;
+    __sync_synchronize ();
+    *copy = h->win[w];
+    __sync_synchronize ();
+  } while (h->seq != seq);
+}
+
+/*
+ * the datagram back datagrams before the newest one (0 = newest); returns
+ * -1 if there is none or it was overwritten while it was read
+ */
+static inline int ms_history_sample (const struct ms_history *h, uint32_t back,
+                                     struct ms_sample *smp, time_t *t) {
+  uint32_t n, i, head = h->head;
+
+  if (back >= head || back >= HIST_LEN)
+    return -1;
+  n = head - 1 - back;
+  i = n % HIST_LEN;
+  __sync_synchronize ();
+  smp->temp = h->temp[i];
+  smp->wind = h->wind[i];
+  smp->dawn = h->dawn[i];
+  smp->sunS = h->sunS[i];
+  smp->sunW = h->sunW[i];
+  smp->sunE = h->sunE[i];
+  smp->flags = h->flags[i];
+  *t = h->time[i];
+  __sync_synchronize ();
+  return (h->head - n < HIST_LEN) ? 0 : -1;   // the writer works on slot head % HIST_LEN
+}
+
+/* writer */
+struct hist_deque {
+  uint32_t n[HIST_LEN];                /* sample numbers, values monotonic */
+  uint32_t first, last;                /* free running, empty if equal */
+};
+
+struct hist_state {
+  uint32_t tail[HIST_WINDOWS];         /* oldest sample still in the window */
+  struct hist_deque min[HIST_WINDOWS][HW_COUNT];
+  struct hist_deque max[HIST_WINDOWS][HW_COUNT];
+};
+
+struct history {
+  char path[200];                      /* "" = off */
+  struct ms_history *h;
+  struct hist_state *st;
+};
+
+int history_open (struct history *hs, const char *path);
+void history_add (struct history *hs, const struct ms_sample *smp, time_t t);
+void history_tick (struct history *hs, time_t now);
+time_t history_deadline (const struct history *hs);
+void history_close (struct history *hs);
+
+#endif /* HISTORY_H */
@@ -0,0 +1,52 @@
+/*
+ * influx.c - InfluxDB line protocol over UDP
+ *
+ * This software is copyright 2008 by Frank Sautter
+ * (eltakoms~at~sautter~dot~com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ */
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include "sink.h"
+
+#define INFLUX_PORT "8089"
+#define INFLUX_MTU  1400               /* bytes per datagram, stay below the path MTU */
+
+/* "influx:host[:port]" */
+static int influx_open (struct sink *sk, const char *arg) {
+  if (sink_resolve (&sk->addr, &sk->addrlen, arg, INFLUX_PORT, SOCK_DGRAM) == -1)
+    return -1;
+  if ((sk->fd = socket (sk->addr.ss_family, SOCK_DGRAM, 0)) == -1)
+    return -1;
+  fcntl (sk->fd, F_SETFL, O_NONBLOCK);
+  sk->max = INFLUX_MTU;
+  return 0;
+}
+
+/* eltakoms,sensor=ttyS0 temp=7.6,wind=1.2,rain=0i,... <nanoseconds> */
+static int influx_format (struct sink *sk, const struct sink_sample *v, char *out, int size) {
+  const struct ms_sample *smp = &v->smp;
+
+  return snprintf (out, size, "eltakoms,sensor=%s temp=%.1f,wind=%.1f,rain=%di,sun_east=%di,"
+                              "sun_south=%di,sun_west=%di,dawn=%di,obscure=%di %lld\n",
+                   v->sensor, (float)smp->temp/10, (float)smp->wind/10, (smp->flags & MS_RAIN) != 0,
+                   smp->sunE, smp->sunS, smp->sunW, smp->dawn, (smp->flags & MS_OBSC) != 0,
+                   (long long)ts_ns (&v->ts.real));
+}
+
+static int influx_send (struct sink *sk, const char *buf, int len) {
+  return (sendto (sk->fd, buf, len, MSG_DONTWAIT, (struct sockaddr *)&sk->addr, sk->addrlen) == len) ? 0 : -1;
+}
+
+static void influx_close (struct sink *sk) {
+}
+
+const struct sink_ops influx_sink = {
+  "influx", influx_open, influx_format, influx_send, NULL, influx_close
+};
@@ -0,0 +1,71 @@
+/*
+ * logfile.c - buffered log file output
+ *
+ * This software is copyright 2008 by Frank Sautter
+ * (eltakoms~at~sautter~dot~com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "logfile.h"
+
+int log_open (struct logfile *lf, const char *path, int flush_n, int flush_t) {
+  if (path != lf->path)
+    snprintf (lf->path, sizeof (lf->path), "%s", path);
+  lf->flush_n = flush_n;
+  lf->flush_t = flush_t;
+  lf->pending = 0;
+  lf->flushed = time (NULL);
+  if ((lf->fp = fopen (lf->path, "a")) == NULL)
+    return -1;
+  setvbuf (lf->fp, lf->buf, _IOFBF, sizeof (lf->buf));
+  return 0;
+}
+
+/* close and open the file again, e.g. after logrotate moved it away */
+int log_reopen (struct logfile *lf) {
+  log_close (lf);
+  return log_open (lf, lf->path, lf->flush_n, lf->flush_t);
+}
+
+void log_write (struct logfile *lf, const char *line, time_t now) {
+  log_put (lf, line, strlen (line), now);
+}
+
+/* one binary record; counts for flush_n like a line */
+void log_put (struct logfile *lf, const void *rec, size_t len, time_t now) {
+  if (lf->fp == NULL)
+    return;
+  fwrite (rec, len, 1, lf->fp);
+  lf->pending++;
+  if (lf->flush_n && lf->pending >= lf->flush_n)
+    log_flush (lf);
+  else
+    log_tick (lf, now);
+}
+
+/* flush if records are waiting longer than flush_t seconds */
+void log_tick (struct logfile *lf, time_t now) {
+  if (lf->pending && lf->flush_t && now - lf->flushed >= lf->flush_t)
+    log_flush (lf);
+}
+
+void log_flush (struct logfile *lf) {
+  if (lf->fp)
+    fflush (lf->fp);
+  lf->pending = 0;
+  lf->flushed = time (NULL);
+}
+
+void log_close (struct logfile *lf) {
+  if (lf->fp) {
+    fclose (lf->fp);
+    lf->fp = NULL;
+  }
+  lf->pending = 0;
+}
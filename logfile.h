@@ -0,0 +1,44 @@
+/*
+ * logfile.h - buffered log file output
+ *
+ * This software is copyright 2008 by Frank Sautter
+ * (eltakoms~at~sautter~dot~com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ */
+
+#ifndef LOGFILE_H
+#define LOGFILE_H
+
+#include <stdio.h>
+#include <time.h>
+
+#define LOG_BUFSIZE 4096
+
+/*
+ * The log file is opened once and written through a stdio buffer. The
+ * buffer is flushed after flush_n records or flush_t seconds (0 = never),
+ * on log_flush() and when the file is closed or reopened.
+ */
+struct logfile {
+  char path[160];
+  FILE *fp;
+  char buf[LOG_BUFSIZE];
+  int flush_n;
+  int flush_t;
+  int pending;                         /* records since last flush */
+  time_t flushed;                      /* time of last flush */
+};
+
+int log_open (struct logfile *lf, const char *path, int flush_n, int flush_t);
+int log_reopen (struct logfile *lf);
+void log_write (struct logfile *lf, const char *line, time_t now);
+void log_put (struct logfile *lf, const void *rec, size_t len, time_t now);
+void log_tick (struct logfile *lf, time_t now);
+void log_flush (struct logfile *lf);
+void log_close (struct logfile *lf);
+
+#endif /* LOGFILE_H */
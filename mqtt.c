@@ -0,0 +1,187 @@
+/*
+ * mqtt.c - MQTT 3.1.1 publisher (QoS 0) over a non-blocking TCP connection
+ *
+ * This software is copyright 2008 by Frank Sautter
+ * (eltakoms~at~sautter~dot~com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <syslog.h>
+#include <sys/socket.h>
+#include "sink.h"
+
+#define MQTT_PORT      "1883"
+#define MQTT_TOPIC     "eltakoMS"
+#define MQTT_KEEPALIVE 60              /* seconds */
+#define MQTT_RETRY     30              /* seconds between connection attempts */
+
+#define MQTT_DOWN       0
+#define MQTT_CONNECTING 1
+#define MQTT_UP         2
+
+/* fixed header: packet type and the variable length remaining length */
+static int mqtt_header (unsigned char *out, int type, int len) {
+  int n = 0;
+
+  out[n++] = type;
+  do {
+    out[n] = len & 0x7f;
+    if ((len >>= 7))
+      out[n] |= 0x80;
+    n++;
+  } while (len);
+  return n;
+}
+
+static void mqtt_down (struct sink *sk, time_t now) {
+  if (sk->fd != -1)
+    close (sk->fd);
+  sk->fd = -1;
+  sk->state = MQTT_DOWN;
+  sk->retry = now + MQTT_RETRY;
+}
+
+static int mqtt_write (struct sink *sk, const void *buf, int len, time_t now) {
+  if (send (sk->fd, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL) != len) {
+    /*
+     * A partial packet would corrupt the stream; slow brokers lose
+     * the connection rather than stall us.
+     */
+    syslog (LOG_ERR, "mqtt %s: %s", sk->spec, strerror (errno));
+    mqtt_down (sk, now);
+    return -1;
+  }
+  sk->active = now;
+  return 0;
+}
+
+/* CONNECT with a clean session; the CONNACK is read and ignored */
+static int mqtt_hello (struct sink *sk, time_t now) {
+  unsigned char pkt[64];
+  char id[24];
+  int idlen = snprintf (id, sizeof (id), "eltakoMS-%d", (int)getpid ());
+  int n = mqtt_header (pkt, 0x10, 12 + idlen);
+
+  memcpy (pkt + n, "\0\4MQTT\4\2", 8);                        // protocol level 4, clean session
+  pkt[n + 8] = MQTT_KEEPALIVE >> 8;
+  pkt[n + 9] = MQTT_KEEPALIVE & 0xff;
+  pkt[n + 10] = idlen >> 8;
+  pkt[n + 11] = idlen & 0xff;
+  memcpy (pkt + n + 12, id, idlen);
+  sk->state = MQTT_UP;
+  return mqtt_write (sk, pkt, n + 12 + idlen, now);
+}
+
+/* move the connection on without ever waiting; returns 0 once it is up */
+static int mqtt_ready (struct sink *sk, time_t now) {
+  struct pollfd pfd;
+  char buf[256];
+  socklen_t len = sizeof (int);
+  int err = 0;
+  ssize_t n;
+
+  switch (sk->state) {
+    case MQTT_DOWN:
+      if (now < sk->retry)
+        return -1;
+      if ((sk->fd = socket (sk->addr.ss_family, SOCK_STREAM, 0)) == -1) {
+        mqtt_down (sk, now);
+        return -1;
+      }
+      fcntl (sk->fd, F_SETFL, O_NONBLOCK);
+      if (connect (sk->fd, (struct sockaddr *)&sk->addr, sk->addrlen) == 0)
+        return mqtt_hello (sk, now);
+      if (errno != EINPROGRESS) {
+        mqtt_down (sk, now);
+        return -1;
+      }
+      sk->state = MQTT_CONNECTING;
+      /* fall through */
+    case MQTT_CONNECTING:
+      pfd.fd = sk->fd;
+      pfd.events = POLLOUT;
+      if (poll (&pfd, 1, 0) <= 0)
+        return -1;
+      if (getsockopt (sk->fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1 || err) {
+        syslog (LOG_ERR, "mqtt %s: %s", sk->spec, strerror (err ? err : errno));
+        mqtt_down (sk, now);
+        return -1;
+      }
+      return mqtt_hello (sk, now);
+    default:
+      while ((n = recv (sk->fd, buf, sizeof (buf), MSG_DONTWAIT)) > 0)
+        ;                                                       // CONNACK, PINGRESP
+      if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+        mqtt_down (sk, now);
+        return -1;
+      }
+      return 0;
+  }
+}
+
+/* "mqtt:host[:port][/topic]", samples go to <topic>/<tty> */
+static int mqtt_open (struct sink *sk, const char *arg) {
+  char hostport[128];
+  const char *t = strchr (arg, '/');
+
+  snprintf (sk->topic, sizeof (sk->topic), "%s", (t && t[1]) ? t + 1 : MQTT_TOPIC);
+  snprintf (hostport, sizeof (hostport), "%.*s", t ? (int)(t - arg) : (int)strlen (arg), arg);
+  sk->state = MQTT_DOWN;
+  return sink_resolve (&sk->addr, &sk->addrlen, hostport, MQTT_PORT, SOCK_STREAM);
+}
+
+/* one PUBLISH packet per sample, the payload is a JSON object */
+static int mqtt_format (struct sink *sk, const struct sink_sample *v, char *out, int size) {
+  const struct ms_sample *smp = &v->smp;
+  char topic[128], payload[256];
+  int tlen, plen, n;
+
+  tlen = snprintf (topic, sizeof (topic), "%s/%s", sk->topic, v->sensor);
+  plen = snprintf (payload, sizeof (payload),
+                   "{\"time\":%lld.%06ld,\"temp\":%.1f,\"wind\":%.1f,\"rain\":%d,\"sun_east\":%d,"
+                   "\"sun_south\":%d,\"sun_west\":%d,\"dawn\":%d,\"obscure\":%d}",
+                   (long long)v->ts.real.tv_sec, v->ts.real.tv_nsec / 1000, (float)smp->temp/10, (float)smp->wind/10, (smp->flags & MS_RAIN) != 0,
+                   smp->sunE, smp->sunS, smp->sunW, smp->dawn, (smp->flags & MS_OBSC) != 0);
+  if (tlen >= sizeof (topic) || plen >= sizeof (payload) || 4 + 2 + tlen + plen > size)
+    return -1;
+
+  n = mqtt_header ((unsigned char *)out, 0x30, 2 + tlen + plen);
+  out[n++] = tlen >> 8;
+  out[n++] = tlen & 0xff;
+  memcpy (out + n, topic, tlen);
+  memcpy (out + n + tlen, payload, plen);
+  return n + tlen + plen;
+}
+
+static int mqtt_send (struct sink *sk, const char *buf, int len) {
+  time_t now = time (NULL);
+
+  if (mqtt_ready (sk, now) == -1)
+    return -1;
+  return mqtt_write (sk, buf, len, now);
+}
+
+/* keep the connection alive and reconnect between batches */
+static void mqtt_tick (struct sink *sk, time_t now) {
+  if (mqtt_ready (sk, now) == 0 && now - sk->active >= MQTT_KEEPALIVE / 2)
+    mqtt_write (sk, "\300\0", 2, now);                          // PINGREQ
+}
+
+static void mqtt_close (struct sink *sk) {
+  if (sk->state == MQTT_UP)
+    mqtt_write (sk, "\340\0", 2, time (NULL));                  // DISCONNECT
+}
+
+const struct sink_ops mqtt_sink = {
+  "mqtt", mqtt_open, mqtt_format, mqtt_send, mqtt_tick, mqtt_close
+};
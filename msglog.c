@@ -0,0 +1,212 @@
+/*
+ * msglog.c - non-blocking syslog client of the writer thread
+ *
+ * This software is copyright 2008 by Frank Sautter
+ * (eltakoms~at~sautter~dot~com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <syslog.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "msglog.h"
+#include "sink.h"
+#include "timestamp.h"
+
+int msglog_open (struct msglog *ml, const char *target, const char *ident, int rfc5424) {
+  struct sockaddr_un *un = (struct sockaddr_un *)&ml->addr;
+  const char *path = (target && target[0]) ? target : MSGLOG_DEVLOG;
+
+  memset (ml, 0, sizeof (*ml));
+  ml->fd = -1;
+  ml->rfc5424 = rfc5424;
+  ml->pid = getpid ();
+  snprintf (ml->target, sizeof (ml->target), "%s", target ? target : "");
+  snprintf (ml->ident, sizeof (ml->ident), "%s", ident);
+  if (gethostname (ml->host, sizeof (ml->host)) == -1 || ml->host[0] == '\0')
+    strcpy (ml->host, "-");
+  ml->host[sizeof (ml->host) - 1] = '\0';
+
+  if (strncmp (path, "unix:", 5) == 0 || path[0] == '/') {
+    if (path[0] != '/')
+      path += 5;
+    if (strlen (path) >= sizeof (un->sun_path))
+      return -1;
+    un->sun_family = AF_UNIX;
+    strcpy (un->sun_path, path);
+    ml->addrlen = sizeof (*un);
+  } else if (sink_resolve (&ml->addr, &ml->addrlen, path, MSGLOG_PORT, SOCK_DGRAM) == -1) {
+    ml->addrlen = 0;
+    return -1;
+  }
+  return 0;
+}
+
+static int msglog_connect (struct msglog *ml) {
+  if (ml->addrlen == 0)
+    return -1;
+  if ((ml->fd = socket (ml->addr.ss_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1)
+    return -1;
+  if (connect (ml->fd, (struct sockaddr *)&ml->addr, ml->addrlen) == -1) {
+    close (ml->fd);
+    ml->fd = -1;
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * Send one message without ever waiting. If syslogd is gone (restarted,
+ * or nothing listens on the port) the socket is connected again once
+ * right away, after that only every MSGLOG_RETRY seconds.
+ */
+static void msglog_write (struct msglog *ml, const char *buf, int len) {
+  time_t now = ts_now ();
+  int tries;
+
+  for (tries = 0; tries < 2; tries++) {
+    if (ml->fd == -1) {
+      if (now < ml->retry)
+        break;
+      if (msglog_connect (ml) == -1) {
+        ml->retry = now + MSGLOG_RETRY;
+        break;
+      }
+    }
+    if (send (ml->fd, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL) == len) {
+      if (ml->stats)
+        ml->stats->sent++;
+      return;
+    }
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS || errno == EMSGSIZE)
+      break;                                                    // full, the socket is fine
+    close (ml->fd);
+    ml->fd = -1;
+  }
+  if (ml->stats)
+    ml->stats->dropped++;
+}
+
+/* structured data element of RFC 5424; err < 0 leaves out err and count */
+static void msglog_sd (char *sd, int size, const char *tty, int err, unsigned int count) {
+  int len = snprintf (sd, size, "[" MSGLOG_SDID " tty=\"");
+
+  for (; *tty && len < size - 40; tty++) {                      // room for the rest
+    if (*tty == '"' || *tty == '\\' || *tty == ']')
+      sd[len++] = '\\';
+    sd[len++] = *tty;
+  }
+  if (err < 0)
+    snprintf (sd + len, size - len, "\"]");
+  else
+    snprintf (sd + len, size - len, "\" err=\"0x%04x\" count=\"%u\"]", err & 0xffff, count);
+}
+
+static void msglog_vsend (struct msglog *ml, int prio, const char *msgid, const char *sd,
+                          const char *fmt, va_list ap) {
+  char buf[MSGLOG_LEN];
+  char date[32];
+  struct timespec now;
+  struct tm tm;
+  int pri = MSGLOG_FACILITY | prio;
+  int len, off;
+
+  clock_gettime (CLOCK_REALTIME, &now);
+  localtime_r (&now.tv_sec, &tm);
+  if (ml->rfc5424) {
+    strftime (date, sizeof (date), "%Y-%m-%dT%H:%M:%S", &tm);
+    off = tm.tm_gmtoff / 60;
+    len = snprintf (buf, sizeof (buf), "<%d>1 %s.%06ld%c%02d:%02d %s %s %d %s %s ",
+                    pri, date, now.tv_nsec / 1000, (off < 0) ? '-' : '+', abs (off) / 60, abs (off) % 60,
+                    ml->host, ml->ident, ml->pid, msgid, sd ? sd : "-");
+  } else {
+    strftime (date, sizeof (date), "%b %e %H:%M:%S", &tm);
+    if (ml->addr.ss_family == AF_UNIX)                          // as syslog (3) writes it
+      len = snprintf (buf, sizeof (buf), "<%d>%s %s[%d]: ", pri, date, ml->ident, ml->pid);
+    else                                                        // a remote one wants the host
+      len = snprintf (buf, sizeof (buf), "<%d>%s %s %s[%d]: ", pri, date, ml->host, ml->ident, ml->pid);
+  }
+  if (len < (int)sizeof (buf))
+    len += vsnprintf (buf + len, sizeof (buf) - len, fmt, ap);
+  if (len >= (int)sizeof (buf))
+    len = sizeof (buf) - 1;
+  msglog_write (ml, buf, len);
+}
+
+void msglog_send (struct msglog *ml, int prio, const char *msgid, const char *tty, const char *fmt, ...) {
+  char sd[128];
+  va_list ap;
+
+  if (ml->rfc5424)
+    msglog_sd (sd, sizeof (sd), tty, -1, 0);
+  va_start (ap, fmt);
+  msglog_vsend (ml, prio, msgid, ml->rfc5424 ? sd : NULL, fmt, ap);
+  va_end (ap);
+}
+
+static void msglog_sendsd (struct msglog *ml, int prio, const char *msgid, const char *sd, const char *fmt, ...)
+  __attribute__ ((format (printf, 5, 6)));
+
+static void msglog_sendsd (struct msglog *ml, int prio, const char *msgid, const char *sd, const char *fmt, ...) {
+  va_list ap;
+
+  va_start (ap, fmt);
+  msglog_vsend (ml, prio, msgid, sd, fmt, ap);
+  va_end (ap);
+}
+
+/* count one bad datagram */
+void msglog_error (struct msglog_errors *me, int err, const char *raw) {
+  int i;
+
+  for (i = 0; i < me->n; i++)
+    if (me->code[i].err == err) {
+      me->code[i].count++;
+      return;
+    }
+  if (me->n == MSGLOG_CODES) {
+    me->other++;
+    me->otherbits |= err;
+    return;
+  }
+  me->code[i].err = err;
+  me->code[i].count = 1;
+  snprintf (me->code[i].first, sizeof (me->code[i].first), "%s", raw);
+  me->n++;
+}
+
+/* one message per error code seen since the last call, then start over */
+void msglog_errors (struct msglog *ml, struct msglog_errors *me, const char *tty, const char *tag) {
+  char sd[128];
+  int i;
+
+  for (i = 0; i < me->n; i++) {
+    msglog_sd (sd, sizeof (sd), tty, me->code[i].err, me->code[i].count);
+    msglog_sendsd (ml, LOG_INFO, "bad", ml->rfc5424 ? sd : NULL, "%s: %u occurrence%s of 0x%04x, first: %s",
+                   tag, me->code[i].count, (me->code[i].count == 1) ? "" : "s", me->code[i].err, me->code[i].first);
+  }
+  if (me->other) {
+    msglog_sd (sd, sizeof (sd), tty, me->otherbits, me->other);
+    msglog_sendsd (ml, LOG_INFO, "bad", ml->rfc5424 ? sd : NULL, "%s: %u more bad datagrams, errors 0x%04x",
+                   tag, me->other, me->otherbits);
+  }
+  me->n = 0;
+  me->other = me->otherbits = 0;
+}
+
+void msglog_close (struct msglog *ml) {
+  if (ml->fd != -1)
+    close (ml->fd);
+  ml->fd = -1;
+}
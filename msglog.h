@@ -0,0 +1,75 @@
+/*
+ * msglog.h - non-blocking syslog client of the writer thread
+ *
+ * This software is copyright 2008 by Frank Sautter
+ * (eltakoms~at~sautter~dot~com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ */
+
+#ifndef MSGLOG_H
+#define MSGLOG_H
+
+#include <time.h>
+#include <sys/socket.h>
+#include "stats.h"
+
+#define MSGLOG_DEVLOG   "/dev/log"
+#define MSGLOG_PORT     "514"          /* syslog over UDP */
+#define MSGLOG_FACILITY LOG_LOCAL5
+#define MSGLOG_SDID     "eltakoMS@32473"   /* structured data of RFC 5424 */
+#define MSGLOG_LEN      1024           /* longest message sent */
+#define MSGLOG_RETRY    10             /* s until a lost syslogd is tried again */
+#define MSGLOG_CODES    8              /* error codes counted apart per interval */
+#define MSGLOG_RAWLEN   64             /* bytes of the first datagram kept per code */
+
+/*
+ * The messages of the writer (bad datagrams, interval records with -s,
+ * alarms, stale sensors) go out on a connected datagram socket of its
+ * own instead of syslog (3), so syslog () connecting or blocking on a
+ * full /dev/log never holds up the writer and with it the queue behind
+ * the reader. A message that cannot be sent right away is dropped and
+ * counted. The target is /dev/log, unix:<path> or <host>[:<port>]
+ * (UDP), the format that of RFC 3164 (what syslog (3) writes) or RFC
+ * 5424 with the tty, and for errors code and count, as structured data.
+ */
+struct msglog {
+  char target[160];                    /* "" = /dev/log */
+  int rfc5424;
+  char ident[32];                      /* APP-NAME */
+  char host[64];                       /* HOSTNAME, RFC 5424 only */
+  int pid;
+  int fd;                              /* -1 = not connected */
+  struct sockaddr_storage addr;
+  socklen_t addrlen;                   /* 0 = target could not be resolved */
+  time_t retry;                        /* next connection attempt */
+  struct ms_log_stats *stats;          /* NULL = not instrumented */
+};
+
+/*
+ * Bad datagrams of one interval, counted per distinct error code with
+ * the first datagram of each; codes beyond MSGLOG_CODES are lumped
+ * together in other.
+ */
+struct msglog_errors {
+  int n;
+  struct {
+    int err;
+    unsigned int count;
+    char first[MSGLOG_RAWLEN];
+  } code[MSGLOG_CODES];
+  unsigned int other;
+  int otherbits;
+};
+
+int msglog_open (struct msglog *ml, const char *target, const char *ident, int rfc5424);
+void msglog_send (struct msglog *ml, int prio, const char *msgid, const char *tty,
+                  const char *fmt, ...) __attribute__ ((format (printf, 5, 6)));
+void msglog_error (struct msglog_errors *me, int err, const char *raw);
+void msglog_errors (struct msglog *ml, struct msglog_errors *me, const char *tty, const char *tag);
+void msglog_close (struct msglog *ml);
+
+#endif /* MSGLOG_H */
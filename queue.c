@@ -0,0 +1,103 @@
+/*
+ * queue.c - single producer, single consumer queue from the tty reader
+ *           to the output writer
+ *
+ * This software is copyright 2008 by Frank Sautter
+ * (eltakoms~at~sautter~dot~com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ */
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include "queue.h"
+
+int queue_init (struct queue *q) {
+  q->head = q->tail = 0;
+  q->peak = q->dropped = 0;
+  q->sleeping = q->closed = 0;
+  if (pipe (q->wake) == -1)
+    return -1;
+  fcntl (q->wake[0], F_SETFL, O_NONBLOCK);
+  fcntl (q->wake[1], F_SETFL, O_NONBLOCK);
+  return 0;
+}
+
+/* producer: returns -1 (and counts a drop) if the queue is full */
+int queue_push (struct queue *q, const struct q_entry *e) {
+  unsigned int head = q->head;
+  unsigned int fill = head - __atomic_load_n (&q->tail, __ATOMIC_ACQUIRE);
+
+  if (fill >= QUEUE_SIZE) {
+    __atomic_store_n (&q->dropped, q->dropped + 1, __ATOMIC_RELAXED);
+    return -1;
+  }
+  q->e[head & (QUEUE_SIZE - 1)] = *e;
+  __atomic_store_n (&q->head, head + 1, __ATOMIC_RELEASE);
+  if (fill + 1 > q->peak)
+    __atomic_store_n (&q->peak, fill + 1, __ATOMIC_RELAXED);
+  return 0;
+}
+
+/* consumer: returns 0 if the queue is empty */
+int queue_pop (struct queue *q, struct q_entry *e) {
+  unsigned int tail = q->tail;
+
+  if (tail == __atomic_load_n (&q->head, __ATOMIC_ACQUIRE))
+    return 0;
+  *e = q->e[tail & (QUEUE_SIZE - 1)];
+  __atomic_store_n (&q->tail, tail + 1, __ATOMIC_RELEASE);
+  return 1;
+}
+
+unsigned int queue_fill (const struct queue *q) {
+  return __atomic_load_n (&q->head, __ATOMIC_ACQUIRE) - __atomic_load_n (&q->tail, __ATOMIC_ACQUIRE);
+}
+
+/* producer: wake the consumer after a batch of pushes, if it sleeps */
+void queue_wake (struct queue *q) {
+  char c = 0;
+
+  __atomic_thread_fence (__ATOMIC_SEQ_CST);                      // head before sleeping
+  if (__atomic_exchange_n (&q->sleeping, 0, __ATOMIC_SEQ_CST))
+    write (q->wake[1], &c, 1);
+}
+
+/*
+ * consumer: sleep until there is something to pop, the queue is closed
+ * or timeout milliseconds passed. Returns 0 once the queue is closed and
+ * empty.
+ */
+int queue_wait (struct queue *q, int timeout) {
+  struct pollfd pfd;
+  char buf[64];
+
+  pfd.fd = q->wake[0];
+  pfd.events = POLLIN;
+  __atomic_store_n (&q->sleeping, 1, __ATOMIC_SEQ_CST);
+  __atomic_thread_fence (__ATOMIC_SEQ_CST);                      // sleeping before head
+  if (queue_fill (q) == 0 && !__atomic_load_n (&q->closed, __ATOMIC_SEQ_CST))
+    poll (&pfd, 1, timeout);
+  __atomic_store_n (&q->sleeping, 0, __ATOMIC_SEQ_CST);
+  while (read (q->wake[0], buf, sizeof (buf)) > 0)
+    ;
+  return !(__atomic_load_n (&q->closed, __ATOMIC_SEQ_CST) && queue_fill (q) == 0);
+}
+
+/* producer: no more entries; the consumer drains the queue and stops */
+void queue_close (struct queue *q) {
+  char c = 0;
+
+  __atomic_store_n (&q->closed, 1, __ATOMIC_SEQ_CST);
+  write (q->wake[1], &c, 1);
+}
+
+/* after the consumer stopped: accept entries again, e.g. for a new consumer */
+void queue_reopen (struct queue *q) {
+  __atomic_store_n (&q->closed, 0, __ATOMIC_SEQ_CST);
+}
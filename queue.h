@@ -0,0 +1,61 @@
+/*
+ * queue.h - single producer, single consumer queue from the tty reader
+ *           to the output writer
+ *
+ * This software is copyright 2008 by Frank Sautter
+ * (eltakoms~at~sautter~dot~com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ */
+
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <time.h>
+#include "datagram.h"
+#include "timestamp.h"
+
+#define QUEUE_SIZE   1024              /* entries, must be a power of two */
+#define QUEUE_RAWLEN 64                /* bytes of a bad datagram kept for the error message */
+
+struct q_entry {
+  time_t t;                            /* steady second, for the windows */
+  struct stamp ts;                     /* read that delivered the ETX */
+  int sensor;
+  int err;                             /* ms_validate() result */
+  struct ms_sample smp;                /* valid if err == 0 */
+  uint32_t alarms;                     /* rules active after this datagram */
+  char raw[QUEUE_RAWLEN];              /* bad datagram if err != 0 */
+};
+
+/*
+ * head is only written by the producer, tail only by the consumer; both
+ * are free running and published with release stores, so neither side
+ * ever takes a lock. A full queue drops the new entry instead of
+ * blocking the reader. The consumer sleeps on a pipe that the producer
+ * writes to only if the consumer said it is going to sleep.
+ */
+struct queue {
+  struct q_entry e[QUEUE_SIZE];
+  unsigned int head;
+  unsigned int tail;
+  unsigned int peak;                   /* highest fill level seen */
+  unsigned int dropped;                /* entries lost because the queue was full */
+  int sleeping;
+  int closed;
+  int wake[2];                         /* pipe, read end polled by the consumer */
+};
+
+int queue_init (struct queue *q);
+int queue_push (struct queue *q, const struct q_entry *e);
+int queue_pop (struct queue *q, struct q_entry *e);
+unsigned int queue_fill (const struct queue *q);
+void queue_wake (struct queue *q);
+int queue_wait (struct queue *q, int timeout);
+void queue_close (struct queue *q);
+void queue_reopen (struct queue *q);
+
+#endif /* QUEUE_H */
@@ -0,0 +1,246 @@
+/*
+ * rollup.c - multi-resolution rollups of the sensor data
+ *
+ * This software is copyright 2008 by Frank Sautter
+ * (eltakoms~at~sautter~dot~com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include "config.h"
+#include "rollup.h"
+#include "binlog.h"
+#include "sink.h"
+#include "timestamp.h"
+
+/* rrdcached is "unix:<path>", "<path>" or "<host>[:<port>]", NULL or "" for rrdtool */
+void rollup_init (struct rollup *ru, const char *rrdcached) {
+  struct sockaddr_un *un = (struct sockaddr_un *)&ru->addr;
+  const char *path = rrdcached;
+
+  memset (ru, 0, sizeof (*ru));
+  ru->fd = -1;
+  if (rrdcached == NULL || rrdcached[0] == '\0')
+    return;
+  snprintf (ru->rrdcached, sizeof (ru->rrdcached), "%s", rrdcached);
+  if (strncmp (path, "unix:", 5) == 0 || path[0] == '/') {
+    if (path[0] != '/')
+      path += 5;
+    if (strlen (path) >= sizeof (un->sun_path)) {
+      syslog (LOG_ERR, "rrdcached socket path too long: %s", path);
+      return;
+    }
+    un->sun_family = AF_UNIX;
+    strcpy (un->sun_path, path);
+    ru->addrlen = sizeof (*un);
+  } else if (sink_resolve (&ru->addr, &ru->addrlen, rrdcached, RRDCACHED_PORT, SOCK_STREAM) == -1)
+    ru->addrlen = 0;
+}
+
+int rollup_add (struct rollup *ru, int period, const char *rrdfile) {
+  struct rollup_window *w;
+
+  if (ru->n >= ROLLUP_MAX || period <= 0)
+    return -1;
+  w = &ru->win[ru->n++];
+  snprintf (w->rrd, sizeof (w->rrd), "%s", rrdfile ? rrdfile : "");
+  w->ru = ru;
+  agg_init (&w->ag, period, ts_now ());
+  return 0;
+}
+
+/* connect to rrdcached; the send timeout keeps a hanging daemon from stalling the writer */
+static int rrdcached_connect (struct rollup *ru) {
+  struct timeval tv = { 1, 0 };
+
+  if (ru->addrlen == 0) {
+    errno = EDESTADDRREQ;
+    return -1;
+  }
+  if ((ru->fd = socket (ru->addr.ss_family, SOCK_STREAM, 0)) == -1)
+    return -1;
+  setsockopt (ru->fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof (tv));
+  if (connect (ru->fd, (struct sockaddr *)&ru->addr, ru->addrlen) == -1) {
+    close (ru->fd);
+    ru->fd = -1;
+    return -1;
+  }
+  ru->alen = 0;
+  return 0;
+}
+
+static void rrdcached_close (struct rollup *ru) {
+  if (ru->fd != -1)
+    close (ru->fd);
+  ru->fd = -1;
+}
+
+/*
+ * read what rrdcached has answered so far without waiting for it. Good
+ * answers start with "0 " ("0 Go ahead..." and "0 errors" for a BATCH),
+ * everything else is the count or the text of failed updates.
+ */
+static void rrdcached_answers (struct rollup *ru) {
+  char *s, *e;
+  ssize_t n;
+
+  while (ru->fd != -1 &&
+         (n = recv (ru->fd, ru->answer + ru->alen, sizeof (ru->answer) - 1 - ru->alen, MSG_DONTWAIT)) != 0) {
+    if (n == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return;
+      break;
+    }
+    ru->alen += n;
+    ru->answer[ru->alen] = '\0';
+    for (s = ru->answer; (e = strchr (s, '\n')) != NULL; s = e + 1) {
+      *e = '\0';
+      if (strncmp (s, "0 ", 2))
+        syslog (LOG_WARNING, "rrdcached: %s", s);
+    }
+    ru->alen -= s - ru->answer;
+    if (ru->alen == sizeof (ru->answer) - 1)
+      ru->alen = 0;                    // overlong line, forget it
+    memmove (ru->answer, s, ru->alen);
+  }
+  rrdcached_close (ru);                // closed by rrdcached or broken
+}
+
+/* send the queued UPDATE lines as one BATCH command */
+static void rrdcached_send (struct rollup *ru) {
+  static const char begin[] = "BATCH\n", end[] = ".\n";
+  const char *p;
+  int len, try;
+  ssize_t n;
+
+  rrdcached_answers (ru);
+  for (try = 0; try < 2; try++) {      // reconnect once if the old connection is gone
+    if (ru->fd == -1 && (ts_now () < ru->retry || rrdcached_connect (ru) == -1))
+      break;
+    if (send (ru->fd, begin, sizeof (begin) - 1, MSG_NOSIGNAL) == sizeof (begin) - 1) {
+      for (p = ru->batch, len = ru->len;
+           len > 0 && (n = send (ru->fd, p, len, MSG_NOSIGNAL)) > 0; p += n, len -= n)
+        ;
+      if (len == 0 && send (ru->fd, end, sizeof (end) - 1, MSG_NOSIGNAL) == sizeof (end) - 1) {
+        ru->len = 0;
+        if (ru->failed)
+          syslog (LOG_NOTICE, "rrdcached %s takes updates again", ru->rrdcached);
+        ru->failed = 0;
+        return;
+      }
+      rrdcached_close (ru);
+      break;                           // a partial BATCH must not be sent twice
+    }
+    rrdcached_close (ru);
+  }
+  if (!ru->failed)                     // once, not for every window until it is back
+    syslog (LOG_ERR, "cannot send updates to rrdcached %s: %m", ru->rrdcached);
+  ru->failed = 1;
+  ru->retry = ts_now () + RRDCACHED_RETRY;
+  ru->len = 0;
+}
+
+/*
+ * queue "update <rrd> <time>:<temp>:<wind>:..." for a closed window with
+ * the values of the logs (see binlog_rrd ()); rrdtool and rrdcached both
+ * take the same line
+ */
+static void window_emit (const struct agg_record *rec, void *arg) {
+  struct rollup_window *w = arg;
+  struct rollup *ru = w->ru;
+  struct binlog_rec r;
+  char values[80], line[sizeof (w->rrd) + 90];
+  int len;
+
+  if (w->rrd[0] == '\0')
+    return;
+  binlog_fill (&r, rec);
+  binlog_rrd (values, sizeof (values), &r);
+  if ((len = snprintf (line, sizeof (line), "update %s %s\n", w->rrd, values)) >= (int)sizeof (line))
+    return;
+
+  if (ru->rrdcached[0]) {
+    if (ru->len + len > (int)sizeof (ru->batch))
+      rrdcached_send (ru);
+    memcpy (ru->batch + ru->len, line, len);
+    ru->len += len;
+    return;
+  }
+  if (ru->rrdtool == NULL &&
+      (ru->rrdtool = popen (RRDTOOL " - >/dev/null", "w")) == NULL) {
+    syslog (LOG_ERR, "cannot start " RRDTOOL);
+    return;
+  }
+  ru->pending++;
+  fputs (line, ru->rrdtool);
+}
+
+static void rollup_flush (struct rollup *ru) {
+  if (ru->len)
+    rrdcached_send (ru);
+  if (ru->pending && ru->rrdtool && fflush (ru->rrdtool) == EOF) { // rrdtool died
+    syslog (LOG_ERR, RRDTOOL " update failed");
+    pclose (ru->rrdtool);
+    ru->rrdtool = NULL;
+  }
+  ru->pending = 0;
+}
+
+void rollup_sample (struct rollup *ru, const struct ms_sample *smp, time_t t) {
+  int i;
+
+  for (i = 0; i < ru->n; i++)
+    agg_add (&ru->win[i].ag, smp, t, window_emit, &ru->win[i]);
+  rollup_flush (ru);
+}
+
+void rollup_tick (struct rollup *ru, time_t now) {
+  int i;
+
+  for (i = 0; i < ru->n; i++)
+    agg_tick (&ru->win[i].ag, now, window_emit, &ru->win[i]);
+  rollup_flush (ru);
+}
+
+/* close the current window of every rollup, e.g. at the end of a replay */
+void rollup_finish (struct rollup *ru) {
+  int i;
+
+  for (i = 0; i < ru->n; i++)
+    agg_tick (&ru->win[i].ag, agg_deadline (&ru->win[i].ag), window_emit, &ru->win[i]);
+  rollup_flush (ru);
+}
+
+/* earliest end of any window, 0 if there are none */
+time_t rollup_deadline (const struct rollup *ru) {
+  time_t d = 0;
+  int i;
+
+  for (i = 0; i < ru->n; i++)
+    if (d == 0 || agg_deadline (&ru->win[i].ag) < d)
+      d = agg_deadline (&ru->win[i].ag);
+  return d;
+}
+
+void rollup_close (struct rollup *ru) {
+  if (ru->rrdcached[0]) {
+    if (ru->len)
+      rrdcached_send (ru);
+    rrdcached_close (ru);
+  }
+  if (ru->rrdtool)
+    pclose (ru->rrdtool);
+  ru->rrdtool = NULL;
+}
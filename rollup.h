@@ -0,0 +1,70 @@
+/*
+ * rollup.h - multi-resolution rollups of the sensor data
+ *
+ * This software is copyright 2008 by Frank Sautter
+ * (eltakoms~at~sautter~dot~com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ */
+
+#ifndef ROLLUP_H
+#define ROLLUP_H
+
+#include <stdio.h>
+#include <time.h>
+#include "datagram.h"
+#include <sys/socket.h>
+#include "aggregate.h"
+
+#define ROLLUP_MAX 8
+#define ROLLUP_BATCH 4096              /* bytes of updates per rrdcached BATCH */
+#define RRDCACHED_PORT "42217"
+#define RRDCACHED_RETRY 30             /* s between connection attempts */
+
+struct rollup;
+
+/* one aligned window of period seconds with avg/min/max per channel */
+struct rollup_window {
+  struct aggregator ag;
+  struct rollup *ru;
+  char rrd[160];                       /* rrd file to update, may be empty */
+};
+
+/*
+ * Closed windows are sent to a single "rrdtool -" process that lives as
+ * long as the daemon; all windows closed at the same time go out as one
+ * batch. Intervals without samples are sent as unknown ("U").
+ *
+ * With rrdcached set the updates go to that rrdcached instead, as one
+ * BATCH command per flush over a socket that stays open, so no rrdtool
+ * runs at all. Its answers are read without waiting.
+ */
+struct rollup {
+  int n;
+  struct rollup_window win[ROLLUP_MAX];
+  FILE *rrdtool;
+  int pending;                         /* updates not yet flushed */
+  char rrdcached[160];                 /* "unix:<path>", "<path>" or "<host>[:<port>]", "" = rrdtool */
+  struct sockaddr_storage addr;        /* of rrdcached, looked up once */
+  socklen_t addrlen;                   /* 0 = unusable */
+  int fd;                              /* to rrdcached, -1 = not connected */
+  int failed;                          /* last send failed, logged already */
+  time_t retry;                        /* no new connection before */
+  char batch[ROLLUP_BATCH];            /* UPDATE lines of the next BATCH */
+  int len;
+  char answer[256];                    /* incomplete line from rrdcached */
+  int alen;
+};
+
+void rollup_init (struct rollup *ru, const char *rrdcached);
+int rollup_add (struct rollup *ru, int period, const char *rrdfile);
+void rollup_sample (struct rollup *ru, const struct ms_sample *smp, time_t t);
+void rollup_tick (struct rollup *ru, time_t now);
+void rollup_finish (struct rollup *ru);
+time_t rollup_deadline (const struct rollup *ru);
+void rollup_close (struct rollup *ru);
+
+#endif /* ROLLUP_H */
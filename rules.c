@@ -0,0 +1,217 @@
+/*
+ * rules.c - threshold alarms and deadbands checked on every datagram
+ *
+ * This software is copyright 2008 by Frank Sautter
+ * (eltakoms~at~sautter~dot~com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <spawn.h>
+#include <syslog.h>
+#include <sys/wait.h>
+#include "rules.h"
+#include "sink.h"
+
+extern char **environ;
+
+static const char *channel[CH_COUNT] = {
+  "temp", "wind", "rain", "sune", "suns", "sunw", "dawn", "obsc"
+};
+
+/* temperature and wind are kept in tenths */
+static int scale (int ch, double v) {
+  if (ch == CH_TEMP || ch == CH_WIND)
+    v *= 10;
+  return (int)(v + ((v < 0) ? -0.5 : 0.5));
+}
+
+int rule_parse (struct rule *r, const char *spec) {
+  const char *act = strchr (spec, ':');
+  char *end;
+  int len;
+
+  memset (r, 0, sizeof (*r));
+  r->fd = -1;
+  len = act ? act - spec : strlen (spec);
+  if (len >= sizeof (r->cond))
+    return -1;
+  memcpy (r->cond, spec, len);
+
+  for (r->ch = 0; r->ch < CH_COUNT; r->ch++)
+    if (strncmp (spec, channel[r->ch], 4) == 0)
+      break;
+  if (r->ch == CH_COUNT || (spec[4] != '>' && spec[4] != '<'))
+    return -1;
+  r->below = (spec[4] == '<');
+  r->on = r->off = scale (r->ch, strtod (spec + 5, &end));
+  if (end == spec + 5)
+    return -1;
+  r->need = 1;
+  if (*end == '/' && (r->need = strtol (end + 1, &end, 10)) < 1)
+    return -1;
+  if (*end == ',')
+    r->off = scale (r->ch, strtod (end + 1, &end));
+  if (end != spec + len)
+    return -1;
+
+  if (act == NULL)
+    r->action = RULE_SHM;
+  else if (strncmp (act, ":exec:", 6) == 0 && act[6]) {
+    r->action = RULE_EXEC;
+    snprintf (r->arg, sizeof (r->arg), "%s", act + 6);
+  } else if (strncmp (act, ":udp:", 5) == 0) {
+    r->action = RULE_UDP;
+    snprintf (r->arg, sizeof (r->arg), "%s", act + 5);
+    if (strchr (r->arg, ':') == NULL ||
+        sink_resolve (&r->addr, &r->addrlen, r->arg, NULL, SOCK_DGRAM) == -1 ||
+        (r->fd = socket (r->addr.ss_family, SOCK_DGRAM, 0)) == -1)
+      return -1;
+    fcntl (r->fd, F_SETFL, O_NONBLOCK);
+  } else if (strcmp (act, ":shm") == 0)
+    r->action = RULE_SHM;
+  else
+    return -1;
+  return 0;
+}
+
+void rule_free (struct rule *r) {
+  if (r->fd != -1)
+    close (r->fd);
+  r->fd = -1;
+}
+
+void rules_add (struct rules *rs, const struct rule *r) {
+  if (rs->n < RULES_MAX)
+    rs->rule[rs->n++] = r;
+}
+
+/*
+ * The command gets the environment of the daemon plus the alarm. The
+ * shell we start only puts it in the background and exits, so it is
+ * reaped right here and the command itself becomes a child of init;
+ * nothing of ours is left to wait for, and no other child of the daemon
+ * (the rrdtool of rollup.c) is ever reaped by mistake.
+ */
+static void rule_exec (const struct rule *r, const char *sensor, int on, int v) {
+  char alarm[24], rule[60], sens[60], value[32];
+  char *argv[] = { "sh", "-c", "/bin/sh -c \"$1\" &", "sh", (char *)r->arg, NULL };
+  char *envp[256];
+  pid_t pid;
+  int n;
+
+  snprintf (alarm, sizeof (alarm), "ELTAKOMS_ALARM=%s", on ? "on" : "off");
+  snprintf (rule, sizeof (rule), "ELTAKOMS_RULE=%s", r->cond);
+  snprintf (sens, sizeof (sens), "ELTAKOMS_SENSOR=%s", sensor);
+  snprintf (value, sizeof (value), "ELTAKOMS_VALUE=%d", v);
+  envp[0] = alarm;
+  envp[1] = rule;
+  envp[2] = sens;
+  envp[3] = value;
+  for (n = 4; environ[n - 4] && n < 255; n++)
+    envp[n] = environ[n - 4];
+  envp[n] = NULL;
+
+  if (posix_spawn (&pid, "/bin/sh", NULL, NULL, argv, envp) != 0)
+    syslog (LOG_ERR, "cannot run %s", r->arg);
+  else
+    while (waitpid (pid, NULL, 0) == -1 && errno == EINTR)
+      ;
+}
+
+static void rule_fire (const struct rule *r, const char *sensor, int on, int v) {
+  char msg[120];
+  int len;
+
+  switch (r->action) {
+    case RULE_EXEC:
+      rule_exec (r, sensor, on, v);
+      break;
+    case RULE_UDP:
+      len = snprintf (msg, sizeof (msg), "%s %s %s %d\n", sensor, r->cond, on ? "on" : "off", v);
+      sendto (r->fd, msg, len, MSG_DONTWAIT, (struct sockaddr *)&r->addr, r->addrlen);
+      break;
+  }
+}
+
+/*
+ * Check one datagram against all rules, firing the actions of every rule
+ * that changes state. Returns the mask of active rules.
+ */
+uint32_t rules_check (struct rules *rs, const struct ms_sample *smp, time_t t, const char *sensor) {
+  const struct rule *r;
+  uint32_t bit;
+  int i, v;
+
+  for (i = 0; i < rs->n; i++) {
+    r = rs->rule[i];
+    bit = 1u << i;
+    v = ms_channel (smp, r->ch);
+    if (!(rs->active & bit)) {
+      if (r->below ? v >= r->on : v <= r->on)
+        rs->count[i] = 0;
+      else if (++rs->count[i] >= r->need) {
+        rs->active |= bit;
+        rule_fire (r, sensor, 1, v);
+      }
+    } else if (r->below ? v >= r->off : v <= r->off) {
+      rs->active &= ~bit;
+      rs->count[i] = 0;
+      rule_fire (r, sensor, 0, v);
+    }
+  }
+  return rs->active;
+}
+
+int deadband_parse (struct deadband *db, const char *spec, int heartbeat) {
+  char *end;
+  int ch;
+
+  memset (db, 0, sizeof (*db));
+  db->heartbeat = heartbeat;
+  if (spec[0] == '\0')
+    return 0;
+  db->on = 1;
+  while (*spec) {
+    for (ch = 0; ch < CH_COUNT; ch++)
+      if (strncmp (spec, channel[ch], 4) == 0)
+        break;
+    if (ch == CH_COUNT || spec[4] != '=')
+      return -1;
+    db->band[ch] = scale (ch, strtod (spec + 5, &end));
+    if (end == spec + 5 || db->band[ch] < 0 || (*end && *end != ','))
+      return -1;
+    spec = *end ? end + 1 : end;
+  }
+  return 0;
+}
+
+/* 1 if smp is to be published; then it becomes the reference */
+int deadband_pass (const struct deadband *db, struct deadband_state *st, const struct ms_sample *smp, time_t t) {
+  int ch, d;
+
+  if (!db->on)
+    return 1;
+  if (st->have && (db->heartbeat == 0 || t - st->t < db->heartbeat)) {
+    for (ch = 0; ch < CH_COUNT; ch++) {
+      d = ms_channel (smp, ch) - ms_channel (&st->smp, ch);
+      if (d != 0 && abs (d) >= db->band[ch])
+        break;
+    }
+    if (ch == CH_COUNT)
+      return 0;
+  }
+  st->have = 1;
+  st->smp = *smp;
+  st->t = t;
+  return 1;
+}
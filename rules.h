@@ -0,0 +1,85 @@
+/*
+ * rules.h - threshold alarms and deadbands checked on every datagram
+ *
+ * This software is copyright 2008 by Frank Sautter
+ * (eltakoms~at~sautter~dot~com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ */
+
+#ifndef RULES_H
+#define RULES_H
+
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include "datagram.h"
+
+#define RULES_MAX     16               /* one bit each in the alarm mask */
+
+#define RULE_SHM      0                /* only flag the status record */
+#define RULE_EXEC     1                /* run a command */
+#define RULE_UDP      2                /* send a line to host:port */
+
+/*
+ * "<channel><op><value>[/<samples>][,<clear>][:<action>]", e.g.
+ *    wind>10.0/3,8.0:exec:/usr/local/bin/awning in
+ *    rain>0:udp:shade.local:5000
+ *    dawn<50
+ * The alarm goes on when the condition holds for <samples> datagrams in
+ * a row and off again once the value is back at <clear> (default <value>)
+ * or beyond. The action runs on both edges.
+ */
+struct rule {
+  char cond[40];                       /* the condition part of the spec */
+  int ch;                              /* CH_* */
+  int below;                           /* '<' instead of '>' */
+  int on, off;                         /* thresholds in channel units */
+  int need;                            /* samples in a row */
+  int action;
+  char arg[160];                       /* command */
+  int fd;                              /* RULE_UDP socket */
+  struct sockaddr_storage addr;
+  socklen_t addrlen;
+};
+
+/* per sensor state of all rules */
+struct rules {
+  int n;
+  const struct rule *rule[RULES_MAX];
+  int count[RULES_MAX];                /* samples in a row beyond the threshold */
+  uint32_t active;                     /* bit per rule that is on */
+};
+
+/*
+ * "<channel>=<delta>[,...]", e.g. temp=0.2,wind=0.5,dawn=10: a datagram
+ * is only published (status, sinks, sample log) when a channel moved by
+ * at least its <delta> from the value last published, any other channel
+ * (rain and obsc always) changed at all, or nothing was published for
+ * <heartbeat> seconds.
+ */
+struct deadband {
+  int on;                              /* 0 = publish every datagram */
+  int band[CH_COUNT];                  /* in channel units, 0 = any change */
+  int heartbeat;                       /* s, 0 = none */
+};
+
+/* per sensor: what was published last */
+struct deadband_state {
+  int have;
+  struct ms_sample smp;
+  time_t t;
+};
+
+int rule_parse (struct rule *r, const char *spec);
+void rule_free (struct rule *r);
+void rules_add (struct rules *rs, const struct rule *r);
+uint32_t rules_check (struct rules *rs, const struct ms_sample *smp, time_t t, const char *sensor);
+int deadband_parse (struct deadband *db, const char *spec, int heartbeat);
+int deadband_pass (const struct deadband *db, struct deadband_state *st, const struct ms_sample *smp, time_t t);
+
+#endif /* RULES_H */
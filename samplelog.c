@@ -0,0 +1,168 @@
+/*
+ * samplelog.c - compact log of every single datagram
+ *
+ * This software is copyright 2008 by Frank Sautter
+ * (eltakoms~at~sautter~dot~com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "samplelog.h"
+
+static unsigned char *put16 (unsigned char *p, unsigned int v) {
+  p[0] = v & 0xff;
+  p[1] = (v >> 8) & 0xff;
+  return p + 2;
+}
+
+static unsigned int get16 (const unsigned char *p) {
+  return p[0] | (p[1] << 8);
+}
+
+/* the record for smp at time t into out (SLOG_MAXREC bytes); returns its length */
+int slog_encode (struct slog_state *s, uint32_t t, const struct ms_sample *smp, unsigned char *out) {
+  const struct ms_sample *o = &s->smp;
+  int dt = t - s->time;
+  int dtemp = smp->temp - o->temp;
+  int dwind = smp->wind - o->wind;
+  unsigned char *p = out + 1;
+
+  *out = smp->flags & SLOG_FLAGS;
+  if (!s->have || s->since_key >= SLOG_KEYEVERY || dt < 1 || dt > 255 ||
+      dtemp < -128 || dtemp > 127 || dwind < -128 || dwind > 127) {
+    *out |= SLOG_KEY;
+    p = put16 (put16 (p, t & 0xffff), t >> 16);
+    p = put16 (p, (uint16_t)smp->temp);
+    p = put16 (p, smp->wind);
+    p = put16 (p, smp->dawn);
+    *p++ = smp->sunS;
+    *p++ = smp->sunW;
+    *p++ = smp->sunE;
+    s->since_key = 0;
+  } else {
+    if (dt != 1) {
+      *out |= SLOG_DT;
+      *p++ = dt;
+    }
+    if (dtemp) {
+      *out |= SLOG_TEMP;
+      *p++ = (uint8_t)(int8_t)dtemp;
+    }
+    if (dwind) {
+      *out |= SLOG_WIND;
+      *p++ = (uint8_t)(int8_t)dwind;
+    }
+    if (smp->dawn != o->dawn || smp->sunS != o->sunS || smp->sunW != o->sunW || smp->sunE != o->sunE) {
+      *out |= SLOG_LIGHT;
+      p = put16 (p, smp->dawn);
+      *p++ = smp->sunS;
+      *p++ = smp->sunW;
+      *p++ = smp->sunE;
+    }
+    s->since_key++;
+  }
+  s->have = 1;
+  s->time = t;
+  s->smp = *smp;
+  return p - out;
+}
+
+/*
+ * Apply the record at p to s; returns its length, 0 if len does not hold
+ * all of it, -1 if there is no key record before it (skip a byte and try again).
+ */
+int slog_decode (struct slog_state *s, const unsigned char *p, int len) {
+  const unsigned char *q = p + 1;
+  int need = 1;
+
+  if (len < 1)
+    return 0;
+  if (*p & SLOG_KEY)
+    need += 13;
+  else {
+    if (!s->have)
+      return -1;
+    need += ((*p & SLOG_DT) != 0) + ((*p & SLOG_TEMP) != 0) + ((*p & SLOG_WIND) != 0) + ((*p & SLOG_LIGHT) ? 5 : 0);
+  }
+  if (len < need)
+    return 0;
+
+  if (*p & SLOG_KEY) {
+    s->time = get16 (q) | ((uint32_t)get16 (q + 2) << 16);
+    s->smp.temp = (int16_t)get16 (q + 4);
+    s->smp.wind = get16 (q + 6);
+    s->smp.dawn = get16 (q + 8);
+    s->smp.sunS = q[10];
+    s->smp.sunW = q[11];
+    s->smp.sunE = q[12];
+    s->have = 1;
+  } else {
+    s->time += (*p & SLOG_DT) ? *q++ : 1;
+    if (*p & SLOG_TEMP)
+      s->smp.temp += (int8_t)*q++;
+    if (*p & SLOG_WIND)
+      s->smp.wind += (int8_t)*q++;
+    if (*p & SLOG_LIGHT) {
+      s->smp.dawn = get16 (q);
+      s->smp.sunS = q[2];
+      s->smp.sunW = q[3];
+      s->smp.sunE = q[4];
+    }
+  }
+  s->smp.flags = *p & SLOG_FLAGS;
+  return need;
+}
+
+/* a new file gets the header; every file starts with a key record */
+static void samplelog_start (struct samplelog *sl) {
+  unsigned char hdr[sizeof (struct slog_hdr)] = { 0 };
+  struct stat sb;
+
+  memset (&sl->st, 0, sizeof (sl->st));
+  sl->skipped = 0;
+  if (sl->lf.fp == NULL || fstat (fileno (sl->lf.fp), &sb) == -1 || sb.st_size > 0)
+    return;
+  put16 (put16 (put16 (hdr, SLOG_MAGIC & 0xffff), SLOG_MAGIC >> 16), SLOG_VERSION);
+  fwrite (hdr, sizeof (hdr), 1, sl->lf.fp);
+}
+
+int samplelog_open (struct samplelog *sl, const char *path, int every, int flush_t) {
+  sl->every = every;
+  if (log_open (&sl->lf, path, 0, flush_t ? flush_t : SLOG_FLUSH) == -1)
+    return -1;
+  samplelog_start (sl);
+  return 0;
+}
+
+int samplelog_reopen (struct samplelog *sl) {
+  if (log_reopen (&sl->lf) == -1)
+    return -1;
+  samplelog_start (sl);
+  return 0;
+}
+
+void samplelog_add (struct samplelog *sl, const struct ms_sample *smp, time_t t) {
+  unsigned char rec[SLOG_MAXREC];
+  int len;
+
+  if (sl->lf.fp == NULL)
+    return;
+  if (sl->every == 0) {
+    if (sl->st.have && memcmp (smp, &sl->st.smp, sizeof (*smp)) == 0)
+      return;                                                   // unchanged
+  } else if (++sl->skipped < sl->every)
+    return;
+  sl->skipped = 0;
+  len = slog_encode (&sl->st, t, smp, rec);
+  log_put (&sl->lf, rec, len, t);
+}
+
+void samplelog_close (struct samplelog *sl) {
+  log_close (&sl->lf);
+}
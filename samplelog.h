@@ -0,0 +1,85 @@
+/*
+ * samplelog.h - compact log of every single datagram
+ *
+ * This software is copyright 2008 by Frank Sautter
+ * (eltakoms~at~sautter~dot~com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ */
+
+#ifndef SAMPLELOG_H
+#define SAMPLELOG_H
+
+#include <stdint.h>
+#include <time.h>
+#include "datagram.h"
+#include "logfile.h"
+
+/*
+ * The file starts with a struct slog_hdr, followed by records of 1 to
+ * 14 bytes, all little endian. The first byte holds the rain and obscurity
+ * flags and tells which fields follow; everything not mentioned is the
+ * same as in the record before:
+ *
+ *   SLOG_KEY    all values: time (4), temp (2), wind (2), dawn (2),
+ *               sunS, sunW, sunE (1 each)
+ *   SLOG_DT     seconds since the record before (1), else 1 s
+ *   SLOG_TEMP   change of the temperature in tenths (1, signed)
+ *   SLOG_WIND   change of the wind in tenths (1, signed)
+ *   SLOG_LIGHT  dawn (2), sunS, sunW, sunE (1 each)
+ *
+ * So a datagram a second later with the same readings is a single byte.
+ * A key record starts every file, follows time steps and changes that
+ * do not fit, and comes at least every SLOG_KEYEVERY records, so a
+ * damaged file can be read again from the next one on.
+ */
+#define SLOG_MAGIC    0x53534d45       /* "EMSS" */
+#define SLOG_VERSION  1
+#define SLOG_KEYEVERY 3600
+#define SLOG_MAXREC   14
+#define SLOG_FLUSH    60               /* s, if -T is not given */
+
+#define SLOG_KEY      0x80
+#define SLOG_DT       0x40
+#define SLOG_TEMP     0x20
+#define SLOG_WIND     0x10
+#define SLOG_LIGHT    0x08
+#define SLOG_FLAGS    (MS_RAIN | MS_OBSC)
+
+struct slog_hdr {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t reserved;
+};
+
+/* the record before, for encoding as well as for decoding */
+struct slog_state {
+  int have;                            /* 0 = next record must be a key */
+  int since_key;                       /* records since the last key record */
+  uint32_t time;
+  struct ms_sample smp;
+};
+
+int slog_encode (struct slog_state *s, uint32_t t, const struct ms_sample *smp, unsigned char *out);
+int slog_decode (struct slog_state *s, const unsigned char *p, int len);
+
+/*
+ * Which datagrams are logged: every <every>th one, or with every = 0
+ * only those that differ from the last one logged.
+ */
+struct samplelog {
+  struct logfile lf;
+  struct slog_state st;
+  int every;
+  int skipped;                         /* datagrams since the last one logged */
+};
+
+int samplelog_open (struct samplelog *sl, const char *path, int every, int flush_t);
+int samplelog_reopen (struct samplelog *sl);
+void samplelog_add (struct samplelog *sl, const struct ms_sample *smp, time_t t);
+void samplelog_close (struct samplelog *sl);
+
+#endif /* SAMPLELOG_H */
@@ -0,0 +1,131 @@
+/*
+ * sink.c - pluggable network outputs for the samples
+ *
+ * This software is copyright 2008 by Frank Sautter
+ * (eltakoms~at~sautter~dot~com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <netdb.h>
+#include <syslog.h>
+#include "sink.h"
+
+static const struct sink_ops *sink_types[] = { &influx_sink, &mqtt_sink, NULL };
+
+/* spec is "<scheme>:<arg>", e.g. "influx:db.local:8089" */
+int sink_open (struct sink *sk, const char *spec) {
+  const struct sink_ops **o;
+  const char *arg = strchr (spec, ':');
+
+  memset (sk, 0, sizeof (*sk));
+  snprintf (sk->spec, sizeof (sk->spec), "%s", spec);
+  sk->fd = -1;
+  sk->max = SINK_BUFSIZE;
+  if (arg == NULL)
+    return -1;
+  for (o = sink_types; *o; o++)
+    if (strlen ((*o)->scheme) == arg - spec && strncmp ((*o)->scheme, spec, arg - spec) == 0) {
+      sk->ops = *o;
+      return sk->ops->open (sk, arg + 1);
+    }
+  return -1;
+}
+
+/* send the batch; it is gone afterwards, whether it could be sent or not */
+void sink_flush (struct sink *sk) {
+  struct timespec start, stop;
+  int ret;
+
+  if (sk->count == 0)
+    return;
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  if ((ret = sk->ops->send (sk, sk->buf, sk->len)) == 0)
+    sk->sent += sk->count;
+  else
+    sk->dropped += sk->count;
+  if (sk->stats) {
+    clock_gettime (CLOCK_MONOTONIC, &stop);
+    hist_add (&sk->stats->latency, (stop.tv_sec - start.tv_sec) * 1000000000ull + stop.tv_nsec - start.tv_nsec);
+    if (ret == 0)
+      sk->stats->sent += sk->count;
+    else
+      sk->stats->dropped += sk->count;
+  }
+  sk->len = sk->count = 0;
+}
+
+/* add n samples to the batch, sending it whenever it is full */
+void sink_write (struct sink *sk, const struct sink_sample *v, int n, time_t now) {
+  char line[512];
+  int i, len;
+
+  for (i = 0; i < n; i++) {
+    if ((len = sk->ops->format (sk, &v[i], line, sizeof (line))) <= 0 || len >= sizeof (line))
+      continue;
+    if (sk->len + len > sk->max)
+      sink_flush (sk);
+    if (sk->count == 0)
+      sk->first = now;
+    memcpy (sk->buf + sk->len, line, len);
+    sk->len += len;
+    sk->count++;
+  }
+  sink_tick (sk, now);
+}
+
+/* send batches older than SINK_LATENCY seconds */
+void sink_tick (struct sink *sk, time_t now) {
+  if (sk->count && now - sk->first >= SINK_LATENCY)
+    sink_flush (sk);
+  if (sk->ops->tick)
+    sk->ops->tick (sk, now);
+}
+
+/* when sink_tick has to run next, 0 if nothing is waiting */
+time_t sink_deadline (const struct sink *sk) {
+  return sk->count ? sk->first + SINK_LATENCY : 0;
+}
+
+void sink_close (struct sink *sk) {
+  if (sk->ops == NULL)
+    return;
+  sink_flush (sk);
+  sk->ops->close (sk);
+  if (sk->fd != -1)
+    close (sk->fd);
+  sk->fd = -1;
+}
+
+/* look up "host[:port]" once, so reconnects never wait for DNS */
+int sink_resolve (struct sockaddr_storage *addr, socklen_t *addrlen, const char *hostport,
+                  const char *port, int type) {
+  struct addrinfo hints, *res;
+  char host[128];
+  const char *p = strrchr (hostport, ':');
+  int err;
+
+  if (p) {
+    snprintf (host, sizeof (host), "%.*s", (int)(p - hostport), hostport);
+    port = p + 1;
+  } else
+    snprintf (host, sizeof (host), "%s", hostport);
+
+  memset (&hints, 0, sizeof (hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = type;
+  if ((err = getaddrinfo (host, port, &hints, &res)) != 0) {
+    syslog (LOG_ERR, "cannot resolve %s: %s", hostport, gai_strerror (err));
+    return -1;
+  }
+  memcpy (addr, res->ai_addr, res->ai_addrlen);
+  *addrlen = res->ai_addrlen;
+  freeaddrinfo (res);
+  return 0;
+}
@@ -0,0 +1,82 @@
+/*
+ * sink.h - pluggable network outputs for the samples
+ *
+ * This software is copyright 2008 by Frank Sautter
+ * (eltakoms~at~sautter~dot~com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ */
+
+#ifndef SINK_H
+#define SINK_H
+
+#include <time.h>
+#include <sys/socket.h>
+#include "datagram.h"
+#include "stats.h"
+#include "timestamp.h"
+
+#define SINK_MAX     4                 /* sinks per daemon */
+#define SINK_BUFSIZE 4096              /* batch buffer per sink */
+#define SINK_LATENCY 5                 /* max seconds a sample waits in the batch */
+
+struct sink_sample {
+  struct stamp ts;                     /* read that delivered the ETX */
+  const char *sensor;                  /* tty name */
+  struct ms_sample smp;
+};
+
+struct sink;
+
+/*
+ * A sink type formats samples into the batch buffer of the sink and
+ * sends a whole batch with one write. send must not block; a batch
+ * that cannot be sent is dropped.
+ */
+struct sink_ops {
+  const char *scheme;                  /* "<scheme>:<arg>" selects the sink */
+  int (*open) (struct sink *sk, const char *arg);
+  int (*format) (struct sink *sk, const struct sink_sample *v, char *out, int size);
+  int (*send) (struct sink *sk, const char *buf, int len);
+  void (*tick) (struct sink *sk, time_t now);     /* may be NULL */
+  void (*close) (struct sink *sk);
+};
+
+extern const struct sink_ops influx_sink;
+extern const struct sink_ops mqtt_sink;
+
+struct sink {
+  const struct sink_ops *ops;
+  char spec[160];
+  int max;                             /* bytes per batch, at most SINK_BUFSIZE */
+  char buf[SINK_BUFSIZE];
+  int len;
+  int count;                           /* samples in buf */
+  time_t first;                        /* time the oldest of them was added */
+  unsigned int sent, dropped;          /* samples */
+  struct ms_sink_stats *stats;         /* NULL = not instrumented */
+
+  /* connection, used by the sink type */
+  int fd;
+  int state;
+  struct sockaddr_storage addr;
+  socklen_t addrlen;
+  time_t retry;                        /* next connection attempt */
+  time_t active;                       /* last time something was sent */
+  char topic[80];
+};
+
+int sink_open (struct sink *sk, const char *spec);
+void sink_write (struct sink *sk, const struct sink_sample *v, int n, time_t now);
+void sink_tick (struct sink *sk, time_t now);
+time_t sink_deadline (const struct sink *sk);
+void sink_flush (struct sink *sk);
+void sink_close (struct sink *sk);
+
+int sink_resolve (struct sockaddr_storage *addr, socklen_t *addrlen, const char *hostport,
+                  const char *port, int type);
+
+#endif /* SINK_H */
@@ -0,0 +1,203 @@
+/*
+ * stats.c - counters and latency histograms of the daemon itself
+ *
+ * This software is copyright 2008 by Frank Sautter
+ * (eltakoms~at~sautter~dot~com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "stats.h"
+
+static struct ms_stats unmapped;       /* if the block cannot be mapped */
+
+static const char *errname[MS_STATS_ERRBITS] = {
+  "length", "sync", "sign", "temp", "suns", "sunw", "sune", "obsc",
+  "dawn", "wind", "rain", "fixed", "csum", "csumval"
+};
+
+static struct ms_stats *stats_map (const char *path) {
+  struct ms_stats *st = MAP_FAILED;
+  int fd;
+
+  if ((fd = open (path, O_RDWR | O_CREAT, 0644)) != -1) {
+    if (ftruncate (fd, sizeof (*st)) == 0)
+      st = mmap (NULL, sizeof (*st), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close (fd);
+  }
+  return (st == MAP_FAILED) ? NULL : st;
+}
+
+/* map the stats block, NULL for private counters; never fails, they then stay private */
+struct ms_stats *stats_open (const char *path) {
+  struct ms_stats *st = NULL;
+
+  if (path)
+    st = stats_map (path);
+  if (st == NULL)
+    st = &unmapped;
+  memset (st, 0, sizeof (*st));
+  st->magic = MS_STATS_MAGIC;
+  st->version = MS_STATS_VERSION;
+  st->size = sizeof (*st) & 0xffff;
+  st->start = time (NULL);
+  return st;
+}
+
+/*
+ * Carry the private counters in st over to the block mapped from path.
+ * Only for a daemon holding its locks: the block may belong to one that
+ * is still running until then. Returns st if the block cannot be mapped.
+ */
+struct ms_stats *stats_share (const char *path, struct ms_stats *st) {
+  struct ms_stats *shared;
+
+  if ((shared = stats_map (path)) == NULL)
+    return st;
+  *shared = *st;
+  return shared;
+}
+
+void stats_count_errors (struct ms_sensor_stats *s, int err) {
+  int i;
+
+  s->bad++;
+  for (i = 0; i < MS_STATS_ERRBITS; i++)
+    if (err & (1 << i))
+      s->err[i]++;
+}
+
+static void prom_hist (FILE *fp, const char *name, const char *label, const struct ms_hist *h) {
+  uint64_t n = 0;
+  int b, e;
+
+  /* cumulative buckets at the powers of two from 1 us to 16 s */
+  for (e = 10, b = 0; e <= 34; e++) {
+    for (; b < HIST_BUCKETS && hist_value (b) < (1ull << e); b++)
+      n += h->bucket[b];
+    fprintf (fp, "%s_bucket{%s,le=\"%g\"} %llu\n", name, label, (double)(1ull << e) / 1e9, (unsigned long long)n);
+  }
+  fprintf (fp, "%s_bucket{%s,le=\"+Inf\"} %llu\n", name, label, (unsigned long long)h->count);
+  fprintf (fp, "%s_sum{%s} %.9f\n", name, label, h->sum / 1e9);
+  fprintf (fp, "%s_count{%s} %llu\n", name, label, (unsigned long long)h->count);
+}
+
+#define PROM_COUNTER(_NAME_, _HELP_) \
+  fprintf (fp, "# HELP " _NAME_ " " _HELP_ "\n# TYPE " _NAME_ " counter\n")
+
+/* Prometheus text exposition format */
+void stats_prometheus (FILE *fp, const struct ms_stats *st) {
+  const struct ms_sensor_stats *s;
+  const struct ms_sink_stats *k;
+  char label[100];
+  int i, j;
+
+  fprintf (fp, "# HELP eltakoms_start_time_seconds Startup time of the daemon.\n"
+               "# TYPE eltakoms_start_time_seconds gauge\n"
+               "eltakoms_start_time_seconds %lld\n", (long long)st->start);
+
+#define SENSOR_COUNTER(_NAME_, _FIELD_, _HELP_) \
+  PROM_COUNTER ("eltakoms_" _NAME_ "_total", _HELP_); \
+  for (i = 0, s = st->sensor; i < MS_STATS_SENSORS; i++, s++) \
+    if (s->tty[0]) \
+      fprintf (fp, "eltakoms_" _NAME_ "_total{sensor=\"%s\"} %llu\n", s->tty, (unsigned long long)s->_FIELD_)
+
+  SENSOR_COUNTER ("bytes", bytes, "Bytes read from the tty.");
+  SENSOR_COUNTER ("reads", reads, "Reads from the tty that got bytes.");
+  SENSOR_COUNTER ("frames", frames, "Datagrams framed.");
+  SENSOR_COUNTER ("frames_good", good, "Datagrams that passed validation.");
+  SENSOR_COUNTER ("frames_bad", bad, "Datagrams that failed validation.");
+  SENSOR_COUNTER ("resyncs", resyncs, "Runs without ETX that were cut.");
+  SENSOR_COUNTER ("partials", partials, "Partial datagrams dropped after a gap.");
+  SENSOR_COUNTER ("dropped", dropped, "Datagrams lost to a full queue.");
+
+  PROM_COUNTER ("eltakoms_frame_errors_total", "Rejected datagrams per error bit.");
+  for (i = 0, s = st->sensor; i < MS_STATS_SENSORS; i++, s++)
+    for (j = 0; s->tty[0] && j < MS_STATS_ERRBITS; j++)
+      fprintf (fp, "eltakoms_frame_errors_total{sensor=\"%s\",error=\"%s\",bit=\"0x%04x\"} %llu\n",
+               s->tty, errname[j], 1 << j, (unsigned long long)s->err[j]);
+
+  PROM_COUNTER ("eltakoms_sink_sent_total", "Samples sent by the sink.");
+  for (i = 0, k = st->sink; i < MS_STATS_SINKS; i++, k++)
+    if (k->name[0])
+      fprintf (fp, "eltakoms_sink_sent_total{sink=\"%s\"} %llu\n", k->name, (unsigned long long)k->sent);
+  PROM_COUNTER ("eltakoms_sink_dropped_total", "Samples the sink could not send.");
+  for (i = 0, k = st->sink; i < MS_STATS_SINKS; i++, k++)
+    if (k->name[0])
+      fprintf (fp, "eltakoms_sink_dropped_total{sink=\"%s\"} %llu\n", k->name, (unsigned long long)k->dropped);
+
+  PROM_COUNTER ("eltakoms_syslog_sent_total", "Messages sent to syslogd.");
+  fprintf (fp, "eltakoms_syslog_sent_total %llu\n", (unsigned long long)st->log.sent);
+  PROM_COUNTER ("eltakoms_syslog_dropped_total", "Messages dropped because syslogd was gone or busy.");
+  fprintf (fp, "eltakoms_syslog_dropped_total %llu\n", (unsigned long long)st->log.dropped);
+
+  fprintf (fp, "# HELP eltakoms_sink_write_seconds Duration of the network writes of a sink.\n"
+               "# TYPE eltakoms_sink_write_seconds histogram\n");
+  for (i = 0, k = st->sink; i < MS_STATS_SINKS; i++, k++)
+    if (k->name[0]) {
+      snprintf (label, sizeof (label), "sink=\"%.64s\"", k->name);
+      prom_hist (fp, "eltakoms_sink_write_seconds", label, &k->latency);
+    }
+}
+
+/* TCP socket for the Prometheus endpoint on all addresses */
+int stats_listen (int port) {
+  struct sockaddr_in6 sa;
+  int on = 1;
+  int fd;
+
+  if ((fd = socket (AF_INET6, SOCK_STREAM, 0)) == -1)
+    return -1;
+  setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof (on));
+  memset (&sa, 0, sizeof (sa));
+  sa.sin6_family = AF_INET6;
+  sa.sin6_addr = in6addr_any;
+  sa.sin6_port = htons (port);
+  if (bind (fd, (struct sockaddr *)&sa, sizeof (sa)) == -1 || listen (fd, 4) == -1) {
+    close (fd);
+    return -1;
+  }
+  return fd;
+}
+
+/*
+ * Answer every connection with the metrics, whatever was asked for.
+ * Runs in a thread of its own, so a slow scraper only delays itself.
+ */
+void stats_serve (int lfd, const struct ms_stats *st) {
+  struct timeval tv = { 5, 0 };
+  char req[1024];
+  FILE *fp;
+  int fd;
+
+  while (1) {
+    if ((fd = accept (lfd, NULL, NULL)) == -1) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      return;
+    }
+    setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv));
+    setsockopt (fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof (tv));
+    recv (fd, req, sizeof (req), 0);                            // the request line
+    if ((fp = fdopen (fd, "w")) == NULL) {
+      close (fd);
+      continue;
+    }
+    fprintf (fp, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nConnection: close\r\n\r\n");
+    stats_prometheus (fp, st);
+    fclose (fp);
+  }
+}
@@ -0,0 +1,118 @@
+/*
+ * stats.h - counters and latency histograms of the daemon itself
+ *
+ * This software is copyright 2008 by Frank Sautter
+ * (eltakoms~at~sautter~dot~com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+ * The stats block is mapped from <shmdir>/<program>.stats once the
+ * devices are locked; replays keep theirs private. Every field
+ * is only ever written by one thread (sensor counters by the reader,
+ * sink and syslog counters by the writer), without locks; readers may see the
+ * counters slightly out of step with each other.
+ */
+#define MS_STATS_MAGIC   0x54534d45    /* "EMST" */
+#define MS_STATS_VERSION 4
+#define MS_STATS_SENSORS 16
+#define MS_STATS_SINKS   4
+#define MS_STATS_ERRBITS 14            /* MS_ERR_LENGTH .. MS_ERR_CSUMVAL */
+
+/*
+ * Log-linear histogram of nanoseconds in the manner of HDR histograms:
+ * every power of two is split into HIST_SUB linear buckets, so values
+ * are kept with about 12% precision from 1 ns to 2^HIST_EXP ns (18 min).
+ */
+#define HIST_SUB     8
+#define HIST_SUBBITS 3
+#define HIST_EXP     40
+#define HIST_BUCKETS (HIST_EXP * HIST_SUB)
+
+struct ms_hist {
+  uint64_t count;
+  uint64_t sum;                        /* ns */
+  uint64_t max;                        /* ns */
+  uint64_t bucket[HIST_BUCKETS];
+};
+
+struct ms_sensor_stats {
+  char tty[32];                        /* "" = unused */
+  uint64_t bytes;                      /* read from the tty */
+  uint64_t reads;                      /* wakeups that got bytes */
+  uint64_t frames;                     /* datagrams framed */
+  uint64_t good;                       /* passed ms_validate() */
+  uint64_t bad;
+  uint64_t resyncs;                    /* runs without ETX that were cut */
+  uint64_t partials;                   /* partial datagrams dropped after a gap */
+  uint64_t dropped;                    /* lost to a full queue */
+  uint64_t err[MS_STATS_ERRBITS];      /* rejected datagrams per error bit */
+};
+
+struct ms_sink_stats {
+  char name[64];                       /* "" = unused */
+  uint64_t sent, dropped;              /* samples */
+  struct ms_hist latency;              /* of every network write */
+};
+
+struct ms_log_stats {
+  uint64_t sent, dropped;              /* messages of the writer to syslogd */
+};
+
+struct ms_stats {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t size;                       /* sizeof (struct ms_stats) & 0xffff */
+  int64_t start;                       /* startup time */
+  struct ms_sensor_stats sensor[MS_STATS_SENSORS];
+  struct ms_sink_stats sink[MS_STATS_SINKS];
+  struct ms_log_stats log;
+};
+
+/* index of the bucket holding v */
+static inline int hist_bucket (uint64_t v) {
+  int e;
+
+  if (v < HIST_SUB)
+    return v;
+  e = 63 - __builtin_clzll (v);                                  // v >= 2^e
+  if (e - HIST_SUBBITS + 1 >= HIST_EXP)
+    return HIST_BUCKETS - 1;
+  return (e - HIST_SUBBITS + 1) * HIST_SUB + ((v >> (e - HIST_SUBBITS)) & (HIST_SUB - 1));
+}
+
+/* lower bound of bucket b */
+static inline uint64_t hist_value (int b) {
+  int e = b / HIST_SUB;
+
+  if (e == 0)
+    return b;
+  return (uint64_t)(HIST_SUB + b % HIST_SUB) << (e - 1);
+}
+
+static inline void hist_add (struct ms_hist *h, uint64_t ns) {
+  h->bucket[hist_bucket (ns)]++;
+  h->sum += ns;
+  if (ns > h->max)
+    h->max = ns;
+  h->count++;
+}
+
+struct ms_stats *stats_open (const char *path);
+struct ms_stats *stats_share (const char *path, struct ms_stats *st);
+void stats_count_errors (struct ms_sensor_stats *s, int err);
+void stats_prometheus (FILE *fp, const struct ms_stats *st);
+int stats_listen (int port);
+void stats_serve (int lfd, const struct ms_stats *st);
+
+#endif /* STATS_H */
@@ -0,0 +1,195 @@
+/*
+ * status.c - current sensor data for pickup by other programs
+ *
+ * This software is copyright 2008 by Frank Sautter
+ * (eltakoms~at~sautter~dot~com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include "status.h"
+
+static int status_format (char *out, int size, const struct ms_sample *smp, int stale) {
+  char rain = (smp->flags & MS_RAIN) ? 'R' : 'r';
+  char obsc = (smp->flags & MS_OBSC) ? 'O' : 'o';
+
+  return snprintf (out, size, "t%+05.1fs%2.2dw%2.2de%2.2d%cd%3.3dv%04.1f%c\n"
+                              "Temperature : %+.1f\n"
+                              "Sun South   : %d\n"
+                              "Sun West    : %d\n"
+                              "Sun East    : %d\n"
+                              "Obscure     : %c\n"
+                              "Dawn        : %d\n"
+                              "Wind        : %.1f\n"
+                              "Rain        : %c\n"
+                              "Stale       : %s\n",
+                   (float)smp->temp/10, smp->sunS, smp->sunW, smp->sunE, obsc, smp->dawn, (float)smp->wind/10, rain,
+                   (float)smp->temp/10, smp->sunS, smp->sunW, smp->sunE, obsc, smp->dawn, (float)smp->wind/10, rain,
+                   stale ? "yes" : "no");
+}
+
+/* wake the readers sleeping in ms_status_wait (); without futexes they poll */
+static void status_wake (struct ms_status *bin) {
+#ifdef __linux__
+  if (bin->waiters)
+    syscall (SYS_futex, &bin->seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#else
+  (void)bin;
+#endif
+}
+
+/* create (or reuse) path with the given size and map it shared */
+static void *status_map (const char *path, size_t size) {
+  void *p;
+  int fd;
+
+  if ((fd = open (path, O_RDWR | O_CREAT, 0644)) == -1)
+    return NULL;
+  if (ftruncate (fd, size) == -1) {
+    close (fd);
+    return NULL;
+  }
+  p = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close (fd);
+  return (p == MAP_FAILED) ? NULL : p;
+}
+
+/*
+ * In the mmap modes the files are created and mapped once; updates are
+ * done in place and the files never appear truncated or empty. The text
+ * view has a fixed size (padded with blanks) and is not protected by the
+ * sequence counter, use the binary record for consistent snapshots.
+ */
+int status_open (struct status *st, const char *path, int mode) {
+  char binf[sizeof (st->path) + 4];
+  struct ms_status *bin;
+
+  memset (st, 0, sizeof (*st));
+  st->mode = mode;
+  snprintf (st->path, sizeof (st->path), "%s", path);
+  if (mode == STATUS_FILE)
+    return 0;
+
+  snprintf (binf, sizeof (binf), "%s.bin", path);
+  if ((st->bin = status_map (binf, sizeof (struct ms_status))) == NULL)
+    return -1;
+  bin = st->bin;
+  if (bin->magic == MS_STATUS_MAGIC && bin->version == MS_STATUS_VERSION && bin->size == sizeof (*bin)) {
+    /*
+     * Readers may have the record mapped already (a restart, or -m/-M
+     * changed by a reload): waiters stays theirs, seq moves on to the
+     * next even value and they are woken to look at the cleared record.
+     */
+    bin->seq |= 1;
+    __sync_synchronize ();
+    memset ((char *)bin + offsetof (struct ms_status, samples), 0,
+            sizeof (*bin) - offsetof (struct ms_status, samples));
+    __sync_synchronize ();
+    bin->seq++;
+    status_wake (bin);
+  } else {
+    memset (bin, 0, sizeof (*bin));
+    bin->magic = MS_STATUS_MAGIC;
+    bin->version = MS_STATUS_VERSION;
+    bin->size = sizeof (*bin);
+  }
+
+  if (mode == STATUS_MMAP) {
+    if ((st->text = status_map (path, STATUS_TEXTLEN)) == NULL)
+      return -1;
+    memset (st->text, ' ', STATUS_TEXTLEN - 1);
+    st->text[STATUS_TEXTLEN - 1] = '\n';
+  }
+  return 0;
+}
+
+/* the text file or view for the last datagram */
+static void status_text (struct status *st) {
+  char text[STATUS_TEXTLEN + 1];
+  FILE *shmfile;
+  int n;
+
+  if (st->mode == STATUS_FILE) {
+    if ((shmfile = fopen (st->path, "w")) != NULL) {
+      status_format (text, sizeof (text), &st->last, st->stale);
+      fputs (text, shmfile);
+      fclose (shmfile);
+    }
+  } else if (st->text) {
+    if ((n = status_format (text, sizeof (text), &st->last, st->stale)) > STATUS_TEXTLEN - 1)
+      n = STATUS_TEXTLEN - 1;
+    memset (text + n, ' ', STATUS_TEXTLEN - 1 - n);
+    text[STATUS_TEXTLEN - 1] = '\n';
+    memcpy (st->text, text, STATUS_TEXTLEN);
+  }
+}
+
+void status_update (struct status *st, const struct ms_sample *smp, time_t t,
+                    uint32_t alarms, const struct ms_queue_stat *q) {
+  st->last = *smp;
+  st->have = 1;
+  st->stale = 0;
+  if (st->mode == STATUS_FILE) {
+    status_text (st);
+    return;
+  }
+
+  st->bin->seq++;                                               // odd: update running
+  __sync_synchronize ();
+  st->bin->samples++;
+  st->bin->time = t;
+  st->bin->smp = *smp;
+  st->bin->alarms = alarms;
+  st->bin->stale = 0;
+  if (q)
+    st->bin->queue = *q;
+  __sync_synchronize ();
+  st->bin->seq++;
+  status_wake (st->bin);
+  status_text (st);
+}
+
+/* mark the data as stale (or fresh again without a new datagram) */
+void status_stale (struct status *st, int stale) {
+  st->stale = stale;
+  if (st->bin) {
+    st->bin->seq++;
+    __sync_synchronize ();
+    st->bin->stale = stale;
+    __sync_synchronize ();
+    st->bin->seq++;
+    status_wake (st->bin);
+  }
+  if (st->have)
+    status_text (st);
+}
+
+void status_interval (struct status *st, const struct agg_record *rec) {
+  if (st->bin == NULL)
+    return;
+  st->bin->seq++;
+  __sync_synchronize ();
+  st->bin->interval = *rec;
+  __sync_synchronize ();
+  st->bin->seq++;
+  status_wake (st->bin);
+}
+
+void status_close (struct status *st) {
+  if (st->bin)
+    munmap (st->bin, sizeof (struct ms_status));
+  if (st->text)
+    munmap (st->text, STATUS_TEXTLEN);
+  st->bin = NULL;
+  st->text = NULL;
+}
@@ -0,0 +1,133 @@
+/*
+ * status.h - current sensor data for pickup by other programs
+ *
+ * This software is copyright 2008 by Frank Sautter
+ * (eltakoms~at~sautter~dot~com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ */
+
+#ifndef STATUS_H
+#define STATUS_H
+
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <limits.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+#include "datagram.h"
+#include "aggregate.h"
+
+/*
+ * Binary status record, mapped from <shmfile>.bin. The writer makes seq
+ * odd before it touches the record and even again afterwards, so a
+ * reader retries until it sees the same even seq before and after its
+ * copy (see ms_status_read()).
+ *
+ * seq doubles as a futex word: ms_status_wait() sleeps until seq moves
+ * on, so readers get woken on every new datagram instead of polling.
+ * The writer only does the wake syscall if waiters is not 0. Without
+ * futexes (not Linux) ms_status_wait() looks at seq every
+ * MS_STATUS_POLL milliseconds instead.
+ */
+#define MS_STATUS_MAGIC   0x454d5331   /* "EMS1" */
+#define MS_STATUS_VERSION 6
+#define MS_STATUS_POLL    10           /* ms between looks at seq without futexes */
+
+/* state of the queue between tty reader and writer when smp was written */
+struct ms_queue_stat {
+  uint32_t queued;                     /* entries waiting */
+  uint32_t peak;                       /* highest fill level since startup */
+  uint32_t dropped;                    /* datagrams of this sensor lost to a full queue */
+};
+
+struct ms_status {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t size;                       /* sizeof (struct ms_status) */
+  volatile uint32_t seq;
+  volatile uint32_t waiters;           /* readers sleeping in ms_status_wait() */
+  uint32_t samples;                    /* valid datagrams since startup */
+  int64_t time;                        /* time of the last datagram */
+  struct ms_sample smp;
+  struct agg_record interval;          /* last closed logging interval */
+  struct ms_queue_stat queue;
+  uint32_t alarms;                     /* bit per rule (-A) that is on */
+  uint32_t stale;                      /* 1 = no valid datagram for -W seconds */
+};
+
+/* take a consistent snapshot of the record; for readers */
+static inline void ms_status_read (const struct ms_status *st, struct ms_status *copy) {
+  uint32_t seq;
+
+  do {
+    while ((seq = st->seq) & 1)
+      ;
+    __sync_synchronize ();
+    *copy = *st;
+    __sync_synchronize ();
+  } while (st->seq != seq);
+}
+
+/*
+ * sleep until seq differs from the even seq of the last snapshot, at most
+ * timeout milliseconds (-1 = forever); returns 0 on news, -1 on timeout
+ */
+static inline int ms_status_wait (struct ms_status *st, uint32_t seq, int timeout) {
+  uint32_t cur;
+#ifdef __linux__
+  struct timespec ts, *tp = NULL;
+
+  if (timeout >= 0) {
+    ts.tv_sec = timeout / 1000;
+    ts.tv_nsec = (timeout % 1000) * 1000000L;
+    tp = &ts;
+  }
+  __sync_fetch_and_add (&st->waiters, 1);
+  while ((cur = st->seq) == seq || (cur & 1 && cur == seq + 1)) {
+    if (syscall (SYS_futex, &st->seq, FUTEX_WAIT, cur, tp, NULL, 0) == -1 && tp)
+      break;                           /* timed out (or interrupted) */
+  }
+  __sync_fetch_and_sub (&st->waiters, 1);
+#else
+  struct timespec ts = { 0, MS_STATUS_POLL * 1000000L };
+
+  while ((cur = st->seq) == seq || (cur & 1 && cur == seq + 1)) {
+    if (timeout >= 0 && (timeout -= MS_STATUS_POLL) < 0)
+      break;
+    nanosleep (&ts, NULL);
+  }
+#endif
+  return (st->seq == seq) ? -1 : 0;
+}
+
+#define STATUS_FILE     0              /* rewrite the text file every time */
+#define STATUS_MMAP     1              /* binary record and text view */
+#define STATUS_MMAP_BIN 2              /* binary record only */
+
+#define STATUS_TEXTLEN  192            /* fixed size of the mapped text view */
+
+struct status {
+  int mode;
+  char path[160];
+  struct ms_status *bin;
+  char *text;
+  int stale;
+  int have;                            /* last is valid */
+  struct ms_sample last;               /* for rewriting the text when stale changes */
+};
+
+int status_open (struct status *st, const char *path, int mode);
+void status_update (struct status *st, const struct ms_sample *smp, time_t t,
+                    uint32_t alarms, const struct ms_queue_stat *q);
+void status_interval (struct status *st, const struct agg_record *rec);
+void status_stale (struct status *st, int stale);
+void status_close (struct status *st);
+
+#endif /* STATUS_H */
@@ -0,0 +1,89 @@
+/*
+ * timestamp.c - receive timestamps and the clock of the logging windows
+ *
+ * This software is copyright 2008 by Frank Sautter
+ * (eltakoms~at~sautter~dot~com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ */
+
+#include <string.h>
+#include "timestamp.h"
+
+int64_t ts_offset;
+static int64_t disciplined;                                     // mono ns of the last adjustment
+static unsigned int tzgen = 1;                                  // 0 = cache never used
+
+/* start the steady clock at the wall clock */
+void ts_init (void) {
+  struct stamp st;
+
+  ts_stamp (&st);
+  __atomic_store_n (&ts_offset, ts_ns (&st.real) - ts_ns (&st.mono), __ATOMIC_RELAXED);
+  disciplined = ts_ns (&st.mono);
+}
+
+void ts_stamp (struct stamp *st) {
+  clock_gettime (CLOCK_REALTIME, &st->real);
+  clock_gettime (CLOCK_MONOTONIC, &st->mono);
+}
+
+/*
+ * Pull the steady clock toward the wall clock of st; only the reader
+ * calls this. Returns the step in ns if the wall clock was followed at
+ * once, else 0.
+ */
+int64_t ts_discipline (const struct stamp *st) {
+  int64_t mono = ts_ns (&st->mono);
+  int64_t diff = ts_ns (&st->real) - (mono + ts_offset);
+  int64_t slew = (mono - disciplined) / 1000 * TS_SLEW / 1000000;
+
+  disciplined = mono;
+  if (diff > (int64_t)TS_MAXSKEW * 1000000000 || diff < -(int64_t)TS_MAXSKEW * 1000000000) {
+    __atomic_store_n (&ts_offset, ts_offset + diff, __ATOMIC_RELAXED);
+    return diff;
+  }
+  if (diff > slew)
+    diff = slew;
+  else if (diff < -slew)
+    diff = -slew;
+  __atomic_store_n (&ts_offset, ts_offset + diff, __ATOMIC_RELAXED);
+  return 0;
+}
+
+/* current second of the steady clock */
+time_t ts_now (void) {
+  struct timespec mono;
+
+  clock_gettime (CLOCK_MONOTONIC, &mono);
+  return (ts_ns (&mono) + __atomic_load_n (&ts_offset, __ATOMIC_RELAXED)) / 1000000000;
+}
+
+/* writes TS_DATELEN characters and a '\0' to out; returns TS_DATELEN */
+int ts_format (struct ts_cache *c, time_t t, char *out) {
+  int sec = t % 60;
+  struct tm tm;
+
+  if (sec < 0)
+    sec += 60;
+  if (c->tzgen != tzgen || t - sec != c->minute) {
+    c->minute = t - sec;
+    c->tzgen = tzgen;
+    localtime_r (&c->minute, &tm);
+    strftime (c->date, sizeof (c->date), "%F %H:%M:00", &tm);
+  }
+  memcpy (out, c->date, TS_DATELEN - 2);
+  out[TS_DATELEN - 2] = '0' + sec / 10;
+  out[TS_DATELEN - 1] = '0' + sec % 10;
+  out[TS_DATELEN] = '\0';
+  return TS_DATELEN;
+}
+
+/* e.g. on SIGHUP, after /etc/localtime or TZ changed */
+void ts_tzchanged (void) {
+  tzset ();
+  tzgen++;
+}
@@ -0,0 +1,71 @@
+/*
+ * timestamp.h - receive timestamps and the clock of the logging windows
+ *
+ * This software is copyright 2008 by Frank Sautter
+ * (eltakoms~at~sautter~dot~com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ */
+
+#ifndef TIMESTAMP_H
+#define TIMESTAMP_H
+
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Every datagram gets the wall clock and the monotonic clock of the read
+ * that delivered its ETX. The wall clock is what goes out to the sinks.
+ *
+ * Windows (intervals, rollups, rule holds) run on a steady clock instead:
+ * the monotonic clock plus an offset that follows the wall clock. The
+ * offset is slewed by at most TS_SLEW per second, so an NTP step of a
+ * few seconds neither cuts a window short nor opens it twice. Steps of
+ * more than TS_MAXSKEW seconds (e.g. the first NTP sync of a box without
+ * RTC) are followed at once.
+ */
+#define TS_SLEW    500000              /* ns per second, like adjtime () */
+#define TS_MAXSKEW 10                  /* s */
+
+struct stamp {
+  struct timespec real;                /* CLOCK_REALTIME */
+  struct timespec mono;                /* CLOCK_MONOTONIC */
+};
+
+extern int64_t ts_offset;              /* ns, steady = mono + ts_offset */
+
+static inline int64_t ts_ns (const struct timespec *t) {
+  return (int64_t)t->tv_sec * 1000000000 + t->tv_nsec;
+}
+
+/* second of the steady clock at st */
+static inline time_t ts_steady (const struct stamp *st) {
+  return (ts_ns (&st->mono) + __atomic_load_n (&ts_offset, __ATOMIC_RELAXED)) / 1000000000;
+}
+
+/*
+ * "%F %H:%M:%S" in local time. The date, hour and minute are formatted
+ * once per minute (time zones and DST change on whole minutes), only the
+ * seconds are filled in every time. ts_tzchanged () rereads the time
+ * zone and makes every cache format again.
+ */
+#define TS_DATELEN 19                  /* "2008-04-03 17:03:20" */
+
+struct ts_cache {
+  time_t minute;                       /* start of the cached minute */
+  unsigned int tzgen;
+  char date[TS_DATELEN + 1];
+};
+
+int ts_format (struct ts_cache *c, time_t t, char *out);
+void ts_tzchanged (void);
+
+void ts_init (void);
+void ts_stamp (struct stamp *st);
+int64_t ts_discipline (const struct stamp *st);
+time_t ts_now (void);
+
+#endif /* TIMESTAMP_H */
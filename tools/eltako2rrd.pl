@@ -2,11 +2,13 @@
 use Time::Local
 
 open (ELTAKO, "eltako.log");
+# one rrdtool for all updates instead of one per bucket
+open (RRDTOOL, "| /usr/bin/rrdtool - >/dev/null") or die "cannot start rrdtool: $!";
 
 my $oldEpoch = -1;
 my $maxObsc = 0, $maxWind = 0, $maxRain = 0;
 while ($record = <ELTAKO>) {
-     $record =~ /^((\d\d\d\d)-(\d\d)-(\d\d)\s(\d\d):(\d\d):(\d\d))\st([+-]\d\d\.\d)s(\d\d)w(\d\d)e(\d\d)([oO])d(\d\d\d)v(\d\d\.\d)([rR])$/;
+     next unless $record =~ /^((\d\d\d\d)-(\d\d)-(\d\d)\s(\d\d):(\d\d):(\d\d))\st([+-]\d\d\.\d)s(\d\d)w(\d\d)e(\d\d)([oO])d(\d\d\d)v(\d\d\.\d)([rR])$/;
      my $epoch = timelocal($7,$6,$5,$4,$3-1,$2);
 
      $accuTemp += $8;
@@ -27,7 +29,7 @@ while ($record = <ELTAKO>) {
        my $avgDawn = $accuDawn / $counter;
 
        $data = sprintf ("%d:%+05.1f:%04.1f:%s:%2.2d:%2.2d:%2.2d:%3.3d:%s\n", $epoch, $avgTemp, $maxWind, $maxRain, $avgSunE, $avgSunS, $avgSunW, $avgDawn, $maxObsc);
-       system("/usr/bin/rrdtool update weather.rrd $data");
+       print RRDTOOL "update weather.rrd $data";
 
        $counter = 0;
        $accuTemp = 0;
@@ -43,4 +45,5 @@ while ($record = <ELTAKO>) {
 
 }
 
-close (ELTAKO)
+close (ELTAKO);
+close (RRDTOOL)
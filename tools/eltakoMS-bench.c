@@ -0,0 +1,420 @@
+/*
+ * eltakoMS-bench times the stages of the eltakoMS hot path separately:
+ * framing, validation, decoding, aggregation, the queue to the writer
+ * thread and the output writers.
+ * All numbers are nanoseconds per datagram.
+ *
+ *   eltakoMS-bench [ -n <datagrams> ] [ <capture> ]
+ *
+ * Without <capture> synthetic datagrams are used; a capture made with
+ * "eltakoMS -c" is framed and its datagrams are used as they are.
+ *
+ * This software is copyright 2008 by Frank Sautter
+ * (eltakoms~at~sautter~dot~com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include "frame.h"
+#include "datagram.h"
+#include "status.h"
+#include "logfile.h"
+#include "aggregate.h"
+#include "queue.h"
+#include "rules.h"
+#include "timestamp.h"
+
+#define MAXSET  4096
+
+struct frameset {
+  const char *name;
+  int n;
+  char buf[MAXSET][LINELEN];
+  int len[MAXSET];
+};
+
+static struct frameset clean, mixed, noisy, captured;
+static char tmpdir[120] = "/tmp";
+static volatile int sink;                                       // keep results alive
+
+static double now (void) {
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void report (const char *stage, const char *variant, double ns, long n) {
+  printf ("%-10s %-28s %10.1f ns/datagram\n", stage, variant, ns / n);
+}
+
+/* a valid datagram with varying values */
+static int make_frame (char *buf, int i) {
+  char body[40];
+  int sum = 0, k;
+
+  snprintf (body, sizeof (body), "W%c%02d.%d%02d%02d%02d%c%03d%02d.%d%c?151515151515?",
+            (i & 1) ? '-' : '+', i % 40, i % 10, i % 100, (i / 3) % 100, (i / 7) % 100,
+            (i % 13) ? 'N' : 'J', i % 1000, i % 30, (i / 11) % 10, (i % 17) ? 'N' : 'J');
+  for (k = 0; k < 35; k++)
+    sum += body[k];
+  return snprintf (buf, LINELEN, "%s%04d\003", body, sum);
+}
+
+/* damage one datagram: bit flip, truncation or garbage */
+static int damage (char *buf, int len, int i) {
+  switch (i % 3) {
+    case 0:
+      buf[i % 39] ^= 1 << (i % 7);
+      return len;
+    case 1:
+      len = 5 + i % 30;
+      buf[len - 1] = 0x03;
+      buf[len] = '\0';
+      return len;
+    default:
+      memset (buf, 'x', 60);
+      buf[60] = 0x03;
+      buf[61] = '\0';
+      return 61;
+  }
+}
+
+static void make_sets (void) {
+  int i;
+
+  clean.name = "clean";
+  mixed.name = "10% bad";
+  noisy.name = "90% bad";
+  clean.n = mixed.n = noisy.n = MAXSET;
+  for (i = 0; i < MAXSET; i++) {
+    clean.len[i] = make_frame (clean.buf[i], i);
+    mixed.len[i] = make_frame (mixed.buf[i], i);
+    noisy.len[i] = make_frame (noisy.buf[i], i);
+    if (i % 10 == 0)
+      mixed.len[i] = damage (mixed.buf[i], mixed.len[i], i);
+    if (i % 10 != 0)
+      noisy.len[i] = damage (noisy.buf[i], noisy.len[i], i);
+  }
+}
+
+static int load_capture (const char *file) {
+  struct framer f;
+  int fd;
+
+  if ((fd = open (file, O_RDONLY)) == -1)
+    return -1;
+  framer_init (&f);
+  f.tee = -1;
+  captured.name = "captured";
+  while (captured.n < MAXSET && framer_fill (&f, fd) > 0)
+    while (captured.n < MAXSET &&
+           (captured.len[captured.n] = framer_next (&f, captured.buf[captured.n], LINELEN)) > 0)
+      captured.n++;
+  close (fd);
+  return captured.n ? 0 : -1;
+}
+
+/* write n datagrams of set to a file for the framing benchmarks */
+static void write_stream (const char *path, const struct frameset *set, long n) {
+  FILE *fp = fopen (path, "w");
+  long i;
+
+  for (i = 0; i < n; i++)
+    fwrite (set->buf[i % set->n], 1, set->len[i % set->n], fp);
+  fclose (fp);
+}
+
+static void bench_framing (long n) {
+  char path[160], buf[LINELEN + 1], *s;
+  struct framer f;
+  double t;
+  long frames;
+  int fd;
+
+  snprintf (path, sizeof (path), "%s/eltakoMS-bench.raw", tmpdir);
+  write_stream (path, &clean, n);
+
+  /* the old loop: one read() per byte */
+  fd = open (path, O_RDONLY);
+  t = now ();
+  for (frames = 0; frames < n; frames++) {
+    s = buf;
+    do {
+      if (read (fd, s++, 1) != 1)
+        break;
+    } while (*(s-1) != 0x03 && (s-buf) < LINELEN);
+  }
+  report ("framing", "read() per byte", now () - t, n);
+  close (fd);
+
+  fd = open (path, O_RDONLY);
+  framer_init (&f);
+  f.tee = -1;
+  t = now ();
+  frames = 0;
+  while (framer_fill (&f, fd) > 0)
+    while (framer_next (&f, buf, LINELEN) > 0)
+      frames++;
+  report ("framing", "ring buffer", now () - t, frames);
+  close (fd);
+  unlink (path);
+}
+
+static void bench_validate (const struct frameset *set, long n) {
+  double t = now ();
+  long i;
+  int err = 0;
+
+  for (i = 0; i < n; i++)
+    err |= ms_validate (set->buf[i % set->n], set->len[i % set->n]);
+  sink = err;
+  report ("validate", set->name, now () - t, n);
+}
+
+static void bench_decode (long n) {
+  struct ms_sample smp;
+  char tmp[LINELEN];
+  double t;
+  long i, acc = 0;
+
+  t = now ();
+  for (i = 0; i < n; i++) {
+    ms_decode (clean.buf[i % clean.n], &smp);
+    acc += smp.temp + smp.wind;
+  }
+  report ("decode", "ms_decode", now () - t, n);
+
+  /* the old way: punch NULs into a copy and atof()/atoi() */
+  t = now ();
+  for (i = 0; i < n; i++) {
+    strncpy (tmp, clean.buf[i % clean.n], LINELEN - 1);
+    tmp[20] = '\0';
+    acc += (int)(atof (tmp + 16) * 10);
+    tmp[16] = '\0';
+    acc += atoi (tmp + 13);
+    tmp[12] = '\0';
+    acc += atoi (tmp + 10);
+    tmp[10] = '\0';
+    acc += atoi (tmp + 8);
+    tmp[8] = '\0';
+    acc += atoi (tmp + 6);
+    tmp[6] = '\0';
+    acc += (int)(atof (tmp + 1) * 10);
+  }
+  report ("decode", "strncpy/atof/atoi", now () - t, n);
+  sink = acc;
+}
+
+static void count_record (const struct agg_record *rec, void *arg) {
+  (*(long *)arg)++;
+}
+
+static void bench_aggregate (long n) {
+  struct aggregator ag;
+  struct ms_sample smp;
+  long i, records = 0;
+  double t;
+
+  ms_decode (clean.buf[0], &smp);
+  agg_init (&ag, 60, 0);
+  t = now ();
+  for (i = 0; i < n; i++) {
+    smp.temp = i % 400;
+    agg_add (&ag, &smp, i, count_record, &records);
+  }
+  report ("aggregate", "agg_add", now () - t, n);
+  sink = records;
+}
+
+static struct queue queue;
+
+/* push and pop in one thread: the cost of the handover without contention */
+static void bench_queue (long n) {
+  struct q_entry e;
+  double t;
+  long i;
+
+  queue_init (&queue);
+  memset (&e, 0, sizeof (e));
+  ms_decode (clean.buf[0], &e.smp);
+  t = now ();
+  for (i = 0; i < n; i++) {
+    e.t = i;
+    queue_push (&queue, &e);
+    queue_pop (&queue, &e);
+  }
+  report ("queue", "push and pop", now () - t, n);
+  sink = e.t;
+}
+
+/* three rules that never fire, as on a calm day */
+static void bench_rules (long n) {
+  static struct rule r[3];
+  struct rules rs;
+  struct ms_sample smp;
+  double t;
+  long i;
+
+  memset (&rs, 0, sizeof (rs));
+  rule_parse (&r[0], "wind>50.0/3,40.0");
+  rule_parse (&r[1], "rain>0");
+  rule_parse (&r[2], "dawn<0");
+  rules_add (&rs, &r[0]);
+  rules_add (&rs, &r[1]);
+  rules_add (&rs, &r[2]);
+  ms_decode (clean.buf[0], &smp);
+  smp.flags = 0;
+  t = now ();
+  for (i = 0; i < n; i++) {
+    smp.wind = i % 400;
+    sink += rules_check (&rs, &smp, i, "bench");
+  }
+  report ("rules", "3 rules", now () - t, n);
+}
+
+static void bench_status (int mode, const char *name, long n) {
+  struct status st;
+  struct ms_sample smp;
+  char path[160];
+  double t;
+  long i;
+
+  snprintf (path, sizeof (path), "%s/eltakoMS-bench.shm", tmpdir);
+  if (status_open (&st, path, mode) == -1) {
+    printf ("status     %-28s cannot open %s\n", name, path);
+    return;
+  }
+  ms_decode (clean.buf[0], &smp);
+  t = now ();
+  for (i = 0; i < n; i++) {
+    smp.wind = i % 1000;
+    status_update (&st, &smp, i, 0, NULL);
+  }
+  report ("status", name, now () - t, n);
+  status_close (&st);
+  unlink (path);
+  strcat (path, ".bin");
+  unlink (path);
+}
+
+static void bench_log (long n) {
+  struct logfile lf;
+  const char *line = "2008-04-03 17:03:20 t+07.6s01w63e00od999v01.2r\n";
+  char path[160];
+  FILE *fp;
+  double t;
+  long i;
+
+  snprintf (path, sizeof (path), "%s/eltakoMS-bench.log", tmpdir);
+
+  /* the old way: fopen/fprintf/fclose per record */
+  unlink (path);
+  t = now ();
+  for (i = 0; i < n; i++) {
+    fp = fopen (path, "a");
+    fputs (line, fp);
+    fclose (fp);
+  }
+  report ("log", "fopen/fclose per record", now () - t, n);
+
+  unlink (path);
+  log_open (&lf, path, 1, 0);
+  t = now ();
+  for (i = 0; i < n; i++)
+    log_write (&lf, line, 0);
+  report ("log", "open, flush every record", now () - t, n);
+  log_close (&lf);
+
+  unlink (path);
+  log_open (&lf, path, 100, 0);
+  t = now ();
+  for (i = 0; i < n; i++)
+    log_write (&lf, line, 0);
+  log_close (&lf);
+  report ("log", "open, flush every 100", now () - t, n);
+  unlink (path);
+}
+
+/* one timestamp per second, as the log of a sensor sees them */
+static void bench_timefmt (long n) {
+  struct ts_cache tc = { 0 };
+  char datestr[80];
+  time_t epoch = 1207235000;
+  double t;
+  long i;
+
+  t = now ();
+  for (i = 0; i < n; i++, epoch++)
+    strftime (datestr, sizeof (datestr), "%F %H:%M:%S", localtime (&epoch));
+  report ("timefmt", "localtime and strftime", now () - t, n);
+  t = now ();
+  for (i = 0; i < n; i++, epoch++)
+    ts_format (&tc, epoch, datestr);
+  report ("timefmt", "ts_format", now () - t, n);
+  sink = datestr[18];
+}
+
+static void bench_syslog (long n) {
+  double t;
+  long i;
+
+  openlog ("eltakoMS-bench", LOG_PID, LOG_LOCAL5);
+  t = now ();
+  for (i = 0; i < n; i++)
+    syslog (LOG_DEBUG, "ELTAKO-MS: t+07.6s01w63e00od999v01.2r");
+  report ("syslog", "syslog()", now () - t, n);
+  closelog ();
+}
+
+int main (int argc, char **argv) {
+  long n = 1000000;
+  int c;
+
+  while ((c = getopt (argc, argv, "n:")) != -1) {
+    switch (c) {
+      case 'n':
+        n = atol (optarg);
+        break;
+      default:
+        printf ("usage: %s [ -n <datagrams> ] [ <capture> ]\n", argv[0]);
+        exit (1);
+    } /* switch () */
+  } /* while getopt */
+  if (getenv ("TMPDIR"))
+    snprintf (tmpdir, sizeof (tmpdir), "%s", getenv ("TMPDIR"));
+
+  make_sets ();
+  if (optind < argc && load_capture (argv[optind]) == -1) {
+    fprintf (stderr, "no datagrams in %s\n", argv[optind]);
+    exit (1);
+  }
+
+  bench_framing (n / 10);
+  bench_validate (&clean, n);
+  bench_validate (&mixed, n);
+  bench_validate (&noisy, n);
+  if (captured.n)
+    bench_validate (&captured, n);
+  bench_decode (n);
+  bench_aggregate (n);
+  bench_queue (n);
+  bench_rules (n);
+  bench_status (STATUS_FILE, "file per datagram", n / 100);
+  bench_status (STATUS_MMAP, "mmap text and binary", n);
+  bench_status (STATUS_MMAP_BIN, "mmap binary", n);
+  bench_log (n / 100);
+  bench_timefmt (n);
+  bench_syslog (n / 1000);
+  return 0;
+}
@@ -0,0 +1,124 @@
+/*
+ * eltakoMS-dump prints a binary eltakoMS log (-b) in the format of the
+ * text log:
+ *    2008-04-03 17:03:20 t+07.6s01w63e00od999v01.2r
+ *
+ * This software is copyright 2008 by Frank Sautter
+ * (eltakoms~at~sautter~dot~com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ */
+
+#define _XOPEN_SOURCE 700
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "binlog.h"
+#include "samplelog.h"
+#include "timestamp.h"
+
+void usage (char *prog) {
+  printf ("usage: %s [ -f <from> ] [ -t <to> ] <binlog> | <samplelog>\n", prog);
+  printf ("\t-f <from>\tfirst interval or datagram to print\n");
+  printf ("\t-t <to>\tprint intervals or datagrams before <to>\n");
+  printf ("\ttimes are seconds since the epoch or \"YYYY-MM-DD HH:MM:SS\"\n");
+}
+
+time_t parsetime (const char *s) {
+  struct tm tm;
+  char *end;
+
+  memset (&tm, 0, sizeof (tm));
+  end = strptime (s, "%Y-%m-%d %H:%M:%S", &tm);
+  if (end && *end == '\0') {
+    tm.tm_isdst = -1;
+    return mktime (&tm);
+  }
+  return (time_t)strtol (s, NULL, 10);
+}
+
+/* a sample log (-S) is decoded from the start; returns -1 if file is none */
+int dump_samples (const char *file, time_t from, time_t to) {
+  static unsigned char buf[65536];
+  struct ts_cache tc = { 0 };
+  struct slog_state st = { 0 };
+  char datestr[TS_DATELEN + 1];
+  struct ms_sample *smp = &st.smp;
+  int len = 0, pos, n;
+  size_t got;
+  FILE *fp;
+
+  if ((fp = fopen (file, "r")) == NULL ||
+      fread (buf, sizeof (struct slog_hdr), 1, fp) != 1 ||
+      (buf[0] | buf[1] << 8 | buf[2] << 16 | (uint32_t)buf[3] << 24) != SLOG_MAGIC) {
+    if (fp)
+      fclose (fp);
+    return -1;
+  }
+  while ((got = fread (buf + len, 1, sizeof (buf) - len, fp)) > 0) {
+    len += got;
+    for (pos = 0; (n = slog_decode (&st, buf + pos, len - pos)) != 0; pos += (n > 0) ? n : 1) {
+      if (n < 0 || st.time < from || (to && st.time >= to))
+        continue;
+      ts_format (&tc, st.time, datestr);
+      printf ("%s t%+05.1fs%2.2dw%2.2de%2.2d%cd%3.3dv%04.1f%c\n", datestr,
+              (float)smp->temp/10, smp->sunS, smp->sunW, smp->sunE,
+              (smp->flags & MS_OBSC) ? 'O' : 'o', smp->dawn,
+              (float)smp->wind/10, (smp->flags & MS_RAIN) ? 'R' : 'r');
+    }
+    memmove (buf, buf + pos, len - pos);                        // incomplete record
+    len -= pos;
+  }
+  fclose (fp);
+  return 0;
+}
+
+int main (int argc, char **argv) {
+  struct binlog_map m;
+  struct ts_cache tc = { 0 };
+  time_t from = 0, to = 0;
+  char datestr[TS_DATELEN + 1];
+  char values[40];
+  uint32_t i;
+  int c;
+
+  while ((c = getopt (argc, argv, "f:t:")) != -1) {
+    switch (c) {
+      case 'f':
+        from = parsetime (optarg);
+        break;
+      case 't':
+        to = parsetime (optarg);
+        break;
+      default:
+        usage (argv[0]);
+        exit (1);
+    } /* switch () */
+  } /* while getopt */
+
+  if (optind != argc - 1) {
+    usage (argv[0]);
+    exit (1);
+  }
+  if (dump_samples (argv[optind], from, to) == 0)
+    return 0;
+  if (binlog_map (&m, argv[optind]) == -1) {
+    fprintf (stderr, "cannot read %s\n", argv[optind]);
+    exit (1);
+  }
+
+  for (i = binlog_find (&m, from); i < m.count; i++) {
+    if (to && m.rec[i].time >= to)
+      break;
+    ts_format (&tc, m.rec[i].time, datestr);
+    binlog_values (values, sizeof (values), &m.rec[i]);
+    printf ("%s %s\n", datestr, values);
+  }
+  binlog_unmap (&m);
+  return 0;
+}
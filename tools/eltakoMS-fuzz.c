@@ -0,0 +1,380 @@
+/*
+ * eltakoMS-fuzz pushes a stream of mutated datagrams through the framing,
+ * validation and decoding of eltakoMS and checks every result against a
+ * plain reference of each stage: a byte-by-byte framer, a validator that
+ * looks at one position after the other and a decoder on strtod()/atoi().
+ * The stream mixes valid datagrams with bit flips, truncated datagrams,
+ * datagrams without ETX (so they run into the next one), runs longer than
+ * LINELEN, garbage, extra bytes before the ETX and checksums followed by
+ * more digits (which the old atoi() took in), and is fed to the framer
+ * through a pipe in chunks of random size, now and then followed by a
+ * framer_discard() as after a gap on the line.
+ *
+ *   eltakoMS-fuzz [ -n <datagrams> ] [ -s <seed> ]
+ *
+ * The same seed gives the same stream. The buffer datagrams are framed
+ * into has guard bytes behind it that must stay untouched; the Makefile
+ * also builds the tool with the address and undefined behaviour
+ * sanitizers. Exits with 1 on the first mismatches.
+ *
+ * This software is copyright 2008 by Frank Sautter
+ * (eltakoms~at~sautter~dot~com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "frame.h"
+#include "datagram.h"
+
+#define CHUNKMAX  256                   /* bytes per write to the pipe */
+#define GUARD     16                    /* bytes behind the datagram buffer */
+#define MAXFAIL   10                    /* mismatches printed before giving up */
+#define ERRBITS   14
+
+static const char *errname[ERRBITS] = {
+  "length", "sync", "sign", "temp", "suns", "sunw", "sune", "obsc",
+  "dawn", "wind", "rain", "fixed", "csum", "csumval"
+};
+
+static uint64_t rng;
+static long fails;
+static long offset;                                             // stream bytes so far
+
+/* xorshift64*, the same sequence on every platform */
+static uint32_t rnd (void) {
+  rng ^= rng >> 12;
+  rng ^= rng << 25;
+  rng ^= rng >> 27;
+  return (uint32_t)((rng * 0x2545f4914f6cdd1dULL) >> 32);
+}
+
+static double now (void) {
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void dump (const char *what, const char *buf, int len) {
+  int i;
+
+  printf ("  %s (%d):", what, len);
+  for (i = 0; i < len; i++)
+    printf ((buf[i] > ' ' && buf[i] < 0x7f) ? " %c" : " %02x", (unsigned char)buf[i]);
+  printf ("\n");
+}
+
+static void fail (const char *stage, const char *fmt, long a, long b) {
+  if (fails++ < MAXFAIL) {
+    printf ("mismatch in %s near stream byte %ld: ", stage, offset);
+    printf (fmt, a, b);
+    printf ("\n");
+  }
+}
+
+/* a valid datagram with random values */
+static int make_frame (char *buf) {
+  char body[40];
+  int sum = 0, k;
+
+  snprintf (body, sizeof (body), "W%c%02u.%u%02u%02u%02u%c%03u%02u.%u%c?151515151515?",
+            (rnd () & 1) ? '-' : '+', rnd () % 100, rnd () % 10, rnd () % 100, rnd () % 100,
+            rnd () % 100, (rnd () & 1) ? 'N' : 'J', rnd () % 1000, rnd () % 100, rnd () % 10,
+            (rnd () & 1) ? 'N' : 'J');
+  for (k = 0; k < 35; k++)
+    sum += body[k];
+  return snprintf (buf, LINELEN, "%s%04d\003", body, sum);
+}
+
+/* next piece of the stream into buf, at most 1024 bytes */
+static int make_segment (char *buf) {
+  int len = make_frame (buf);
+  int r = rnd () % 100, i, n, sum;
+
+  if (r < 50)                                                   // as it should be
+    return len;
+  if (r < 62) {                                                 // bit flips
+    for (n = 1 + rnd () % 3; n; n--)
+      buf[rnd () % len] ^= 1 << (rnd () % 8);
+    return len;
+  }
+  if (r < 70) {                                                 // truncated
+    len = 1 + rnd () % (MS_DGRAMLEN - 2);
+    if (rnd () & 1)
+      buf[len++] = FRAME_ETX;
+    return len;
+  }
+  if (r < 76)                                                   // no ETX, runs into the next one
+    return len - 1;
+  if (r < 82) {                                                 // longer than LINELEN
+    n = LINELEN - 20 + rnd () % 700;
+    for (i = 0; i < n; i++)
+      buf[i] = (rnd () % 40) ? ' ' + rnd () % 95 : FRAME_SYNC;
+    return n;
+  }
+  if (r < 88) {                                                 // line noise, ETX and NUL too
+    n = 1 + rnd () % 30;
+    for (i = 0; i < n; i++)
+      buf[i] = rnd () % 4 ? rnd () % 256 : FRAME_ETX;
+    return n;
+  }
+  if (r < 91) {                                                 // extra bytes before the ETX
+    n = 1 + rnd () % 5;
+    for (i = 0; i < n; i++)
+      buf[len - 1 + i] = (rnd () & 1) ? '0' + rnd () % 10 : ' ' + rnd () % 95;
+    buf[len - 1 + n] = FRAME_ETX;
+    return len + n;
+  }
+  if (r < 94) {                                                 // right checksum in 5 digits, more behind
+    for (i = 0, sum = 0; i < 35; i++)
+      sum += buf[i];
+    return 35 + snprintf (buf + 35, 16, "%05d%u\003", sum, rnd () % 100);
+  }
+  for (i = 35; i < 39; i++)                                     // wrong checksum
+    buf[i] = '0' + rnd () % 10;
+  return len;
+}
+
+/* the framer the way the old read loop did it, one byte at a time */
+struct ref_framer {
+  char cur[LINELEN];
+  int len;
+  int resync;
+  unsigned int resyncs, partials;
+  int n;                                                        // datagrams waiting in out[]
+  char out[CHUNKMAX][LINELEN];
+  int outlen[CHUNKMAX];
+};
+
+static void ref_emit (struct ref_framer *r) {
+  memcpy (r->out[r->n], r->cur, r->len);
+  r->outlen[r->n++] = r->len;
+  r->len = 0;
+}
+
+static void ref_byte (struct ref_framer *r, unsigned char c) {
+  if (r->resync) {                                              // skip up to the next 'W'
+    if (c == FRAME_ETX)
+      r->resync = 0;
+    if (c != FRAME_SYNC)
+      return;
+    r->resync = 0;
+  }
+  r->cur[r->len++] = c;
+  if (c == FRAME_ETX)
+    ref_emit (r);
+  else if (r->len == LINELEN - 1) {                               // cut, and resync
+    ref_emit (r);
+    r->resync = 1;
+    r->resyncs++;
+  }
+}
+
+static void ref_discard (struct ref_framer *r) {
+  if (r->len)
+    r->partials++;
+  r->len = 0;
+  r->resync = 0;
+}
+
+static int digit (const char *buf, int i) {
+  return buf[i] >= '0' && buf[i] <= '9';
+}
+
+/* the checks of the datagram description, position by position */
+static int ref_validate (const char *buf, int len) {
+  int err = (len != MS_DGRAMLEN) ? MS_ERR_LENGTH : 0;
+  int i, sum = 0;
+
+  if (buf[0] != 'W')
+    err |= MS_ERR_SYNC;
+  if (buf[1] != '+' && buf[1] != '-')
+    err |= MS_ERR_SIGN;
+  if (!digit (buf, 2) || !digit (buf, 3) || buf[4] != '.' || !digit (buf, 5))
+    err |= MS_ERR_TEMP;
+  if (!digit (buf, 6) || !digit (buf, 7))
+    err |= MS_ERR_SUNS;
+  if (!digit (buf, 8) || !digit (buf, 9))
+    err |= MS_ERR_SUNW;
+  if (!digit (buf, 10) || !digit (buf, 11))
+    err |= MS_ERR_SUNE;
+  if (buf[12] != 'J' && buf[12] != 'N')
+    err |= MS_ERR_OBSC;
+  if (!digit (buf, 13) || !digit (buf, 14) || !digit (buf, 15))
+    err |= MS_ERR_DAWN;
+  if (!digit (buf, 16) || !digit (buf, 17) || buf[18] != '.' || !digit (buf, 19))
+    err |= MS_ERR_WIND;
+  if (buf[20] != 'J' && buf[20] != 'N')
+    err |= MS_ERR_RAIN;
+  if (memcmp (buf + 21, "?151515151515?", 14) != 0)
+    err |= MS_ERR_FIXED;
+  if (!digit (buf, 35) || !digit (buf, 36) || !digit (buf, 37) || !digit (buf, 38))
+    return err | MS_ERR_CSUM | MS_ERR_CSUMVAL;
+
+  for (i = 0; i < 35; i++)
+    sum += buf[i];                                              // char, as it always was
+  if (sum != atoi (buf + 35))                                   // as it always was, digits past the ETX too
+    err |= MS_ERR_CSUMVAL;
+  return err;
+}
+
+static int field (const char *buf, int pos, int len, int tenths) {
+  char tmp[8];
+
+  memcpy (tmp, buf + pos, len);
+  tmp[len] = '\0';
+  return tenths ? (int)lround (strtod (tmp, NULL) * 10) : atoi (tmp);
+}
+
+static void ref_decode (const char *buf, struct ms_sample *smp) {
+  smp->temp = field (buf, 1, 5, 1);
+  smp->sunS = field (buf, 6, 2, 0);
+  smp->sunW = field (buf, 8, 2, 0);
+  smp->sunE = field (buf, 10, 2, 0);
+  smp->dawn = field (buf, 13, 3, 0);
+  smp->wind = field (buf, 16, 4, 1);
+  smp->flags = ((buf[20] == 'J') ? MS_RAIN : 0) | ((buf[12] == 'J') ? MS_OBSC : 0);
+}
+
+int main (int argc, char **argv) {
+  static struct ref_framer ref;
+  struct framer f;
+  struct ms_sample smp, rsmp;
+  char seg[1024], chunk[CHUNKMAX], *buf;
+  long n = 1000000, segs = 0, bytes = 0, reads = 0;
+  long frames = 0, good = 0, errs[ERRBITS] = { 0 };
+  unsigned long seed = 1;
+  int segpos = 0, seglen = 0, fd[2], c, i, k, len, err, rerr, got;
+  ssize_t r;
+  double t, spent = 0;
+
+  while ((c = getopt (argc, argv, "n:s:")) != -1) {
+    switch (c) {
+      case 'n':
+        n = atol (optarg);
+        break;
+      case 's':
+        seed = strtoul (optarg, NULL, 0);
+        break;
+      default:
+        printf ("usage: %s [ -n <datagrams> ] [ -s <seed> ]\n", argv[0]);
+        exit (1);
+    } /* switch () */
+  } /* while getopt */
+
+  rng = seed * 0x9e3779b97f4a7c15ULL + 1;
+  if (pipe (fd) == -1 || (buf = malloc (LINELEN + GUARD)) == NULL) {
+    perror ("eltakoMS-fuzz");
+    exit (1);
+  }
+  memset (buf, 0xa5, LINELEN + GUARD);
+  framer_init (&f);
+  f.tee = -1;
+
+  while (segs < n && fails == 0) {
+    /* the next chunk of the stream, 1 .. CHUNKMAX bytes, mostly short */
+    len = 1 + rnd () % ((rnd () & 1) ? 16 : CHUNKMAX);
+    for (k = 0; k < len; k++) {
+      if (segpos == seglen) {
+        seglen = make_segment (seg);
+        segpos = 0;
+        segs++;
+      }
+      chunk[k] = seg[segpos++];
+    }
+    if (write (fd[1], chunk, len) != len) {
+      perror ("eltakoMS-fuzz: pipe");
+      exit (1);
+    }
+    ref.n = 0;
+    for (k = 0; k < len; k++)
+      ref_byte (&ref, chunk[k]);
+
+    /* the same bytes through the real thing */
+    for (got = 0, k = 0; got < len; got += r) {
+      t = now ();
+      r = framer_fill (&f, fd[0]);
+      reads++;
+      while ((i = framer_next (&f, buf, LINELEN)) > 0) {
+        err = ms_validate (buf, i);
+        if (err == 0)
+          ms_decode (buf, &smp);
+        spent += now () - t;
+
+        if (i >= LINELEN || buf[i] != '\0')
+          fail ("framer", "length %ld or no NUL behind it (%ld)", i, buf[i]);
+        for (c = LINELEN; c < LINELEN + GUARD; c++)
+          if ((unsigned char)buf[c] != 0xa5)
+            fail ("framer", "wrote guard byte %ld (%ld)", c - LINELEN, (unsigned char)buf[c]);
+        if (k == ref.n || ref.outlen[k] != i || memcmp (ref.out[k], buf, i) != 0) {
+          fail ("framer", "datagram %ld of the chunk, length %ld", k, i);
+          if (k < ref.n)
+            dump ("expected", ref.out[k], ref.outlen[k]);
+          dump ("got", buf, i);
+        }
+        k++;
+        frames++;
+        if ((rerr = ref_validate (buf, i)) != err) {
+          fail ("validate", "0x%04lx instead of 0x%04lx", err, rerr);
+          dump ("datagram", buf, i);
+        }
+        for (c = 0; c < ERRBITS; c++)
+          if (err & (1 << c))
+            errs[c]++;
+        if (err == 0) {
+          good++;
+          ref_decode (buf, &rsmp);
+          if (memcmp (&smp, &rsmp, sizeof (smp)) != 0) {
+            fail ("decode", "temp %ld instead of %ld (or another channel)", smp.temp, rsmp.temp);
+            dump ("datagram", buf, i);
+          }
+        }
+        t = now ();
+      }
+      spent += now () - t;
+      if (r <= 0) {
+        perror ("eltakoMS-fuzz: framer_fill");
+        exit (1);
+      }
+    }
+    if (k != ref.n)
+      fail ("framer", "%ld datagrams instead of %ld", k, ref.n);
+    offset += len;
+    bytes += len;
+
+    if (rnd () % 64 == 0) {                                     // a gap on the line
+      framer_discard (&f);
+      ref_discard (&ref);
+    }
+  }
+  if (f.resyncs != ref.resyncs)
+    fail ("framer", "%ld resyncs instead of %ld", f.resyncs, ref.resyncs);
+  if (f.partials != ref.partials)
+    fail ("framer", "%ld partials instead of %ld", f.partials, ref.partials);
+
+  printf ("seed %lu: %ld pieces, %ld bytes in %ld reads\n", seed, segs, bytes, reads);
+  printf ("framed %ld datagrams: %ld valid, %ld bad, %u resyncs, %u partials\n",
+          frames, good, frames - good, f.resyncs, f.partials);
+  printf ("errors:");
+  for (c = 0; c < ERRBITS; c++)
+    printf (" %s %ld", errname[c], errs[c]);
+  printf ("\n");
+  if (frames && spent > 0)
+    printf ("framer_fill/next, ms_validate, ms_decode: %.1f ns/datagram, %.1f MB/s\n",
+            spent / frames, bytes * 1e3 / spent);
+  printf ("%ld mismatches\n", fails);
+  free (buf);
+  close (fd[0]);
+  close (fd[1]);
+  return fails ? 1 : 0;
+}
@@ -0,0 +1,405 @@
+/*
+ * eltakoMS-import recomputes intervals from old text logs of eltakoMS
+ * (or the eltako.log of tools/eltako2rrd.pl), lines like
+ *    2008-04-03 17:03:20 t+07.6s01w63e00od999v01.2r
+ *
+ *   eltakoMS-import [ -i <interval> ] [ -j <threads> ] [ -b <binlog> ] [ -R <rrd> ] <log> ...
+ *
+ * and writes them to a binary log (-b), updates a rrd (-R) or, without
+ * either, prints them in the format of the text log. Give the logs
+ * oldest first; they are treated as one.
+ *
+ * Every log is mapped and cut at line boundaries into chunks that are
+ * parsed and aggregated on all cores at once. A line counts for the
+ * interval it ends, like the intervals of the daemon, and the windows
+ * where two chunks meet are merged before they are written.
+ *
+ * This software is copyright 2008 by Frank Sautter
+ * (eltakoms~at~sautter~dot~com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "config.h"
+#include "aggregate.h"
+#include "binlog.h"
+#include "timestamp.h"
+
+#define CHUNK      (16 << 20)          /* bytes of log per thread and round */
+#define MAXTHREADS 64
+#define LOGLINE     "9999-99-99 99:99:99 t?99.9s99w99e99Od999v99.9R"
+#define LOGLINE_LEN (sizeof (LOGLINE) - 1)
+
+/*
+ * The hour of the last line and when it began. The hour that repeats
+ * when DST ends begins twice, at base and alt (alt = base for every
+ * other hour); the log goes on with the second one once the minutes and
+ * seconds go back.
+ */
+struct hour {
+  char text[13];                       /* "YYYY-MM-DD HH" */
+  time_t base, alt;
+  int secs;                            /* into the hour, of the last line */
+};
+
+struct chunk {
+  const char *p, *end;                 /* whole lines */
+  int interval;
+  struct agg_record *win;              /* closed windows in time order */
+  size_t n, size;
+  unsigned long lines, skipped;
+  int nomem;
+};
+
+/* where the merged windows go */
+struct output {
+  struct binlog bl;
+  uint32_t after;                      /* binlog holds intervals up to here */
+  FILE *rrd;
+  const char *rrdfile;
+  int text;
+  struct ts_cache tc;
+  unsigned long windows, old;
+};
+
+void usage (char *prog) {
+  printf ("usage: %s [ -i <interval> ] [ -j <threads> ] [ -b <binlog> ] [ -R <rrd> ] <log> ...\n", prog);
+  printf ("\t-i <interval>\tseconds per interval (default 300)\n");
+  printf ("\t-j <threads>\tparse with <threads> threads (default: one per cpu)\n");
+  printf ("\t-b <binlog>\tappend the intervals to binary <binlog>\n");
+  printf ("\t-R <rrd>\tupdate <rrd> through a single " RRDTOOL "\n");
+  printf ("\twithout -b and -R the intervals are printed like the text log\n");
+}
+
+/*
+ * check a line against LOGLINE (9 = digit, ? = sign, O and R either case,
+ * blank = space or tab) and decode it; the hour is looked up with
+ * mktime () only when it changes. Returns -1 for anything else.
+ */
+static int parse_line (const char *s, int len, struct hour *h, time_t *t, struct ms_sample *smp) {
+  struct tm tm, other;
+  const char *l = LOGLINE;
+  time_t alt;
+  int i, secs;
+
+  if (len > 0 && s[len - 1] == '\r')
+    len--;
+  if (len != LOGLINE_LEN)
+    return -1;
+  for (i = 0; i < LOGLINE_LEN; i++) {
+    switch (l[i]) {
+      case '9':
+        if ((unsigned)(s[i] - '0') > 9)
+          return -1;
+        break;
+      case '?':
+        if (s[i] != '+' && s[i] != '-')
+          return -1;
+        break;
+      case 'O':
+      case 'R':
+        if ((s[i] | 0x20) != (l[i] | 0x20))
+          return -1;
+        break;
+      case ' ':
+        if (s[i] != ' ' && s[i] != '\t')
+          return -1;
+        break;
+      default:
+        if (s[i] != l[i])
+          return -1;
+    } /* switch () */
+  }
+
+#define N2(_P_) ((s[_P_] - '0') * 10 + s[(_P_) + 1] - '0')
+#define N3(_P_) ((s[_P_] - '0') * 100 + N2 ((_P_) + 1))
+  secs = N2 (14) * 60 + N2 (17);
+  if (memcmp (h->text, s, 13)) {       // "YYYY-MM-DD HH"
+    memset (&tm, 0, sizeof (tm));
+    tm.tm_year = N2 (0) * 100 + N2 (2) - 1900;
+    tm.tm_mon = N2 (5) - 1;
+    tm.tm_mday = N2 (8);
+    tm.tm_hour = N2 (11);
+    tm.tm_isdst = -1;
+    other = tm;
+    if ((h->base = mktime (&tm)) == (time_t)-1)
+      return -1;
+    h->alt = h->base;
+    other.tm_isdst = !tm.tm_isdst;     // the same hour on the other side of DST?
+    if (tm.tm_isdst >= 0 && (alt = mktime (&other)) != (time_t)-1 &&
+        other.tm_hour == tm.tm_hour && other.tm_isdst != tm.tm_isdst) {
+      if (alt < h->base) {
+        h->alt = h->base;
+        h->base = alt;
+      } else
+        h->alt = alt;
+    }
+    memcpy (h->text, s, 13);
+  } else if (secs < h->secs)           // the hour repeats
+    h->base = h->alt;
+  h->secs = secs;
+  *t = h->base + secs;
+
+  smp->temp = N2 (22) * 10 + s[25] - '0';
+  if (s[21] == '-')
+    smp->temp = -smp->temp;
+  smp->sunS = N2 (27);
+  smp->sunW = N2 (30);
+  smp->sunE = N2 (33);
+  smp->dawn = N3 (37);
+  smp->wind = N2 (41) * 10 + s[44] - '0';
+  smp->flags = (s[35] == 'O' ? MS_OBSC : 0) | (s[45] == 'R' ? MS_RAIN : 0);
+  return 0;
+}
+
+static void collect (const struct agg_record *rec, void *arg) {
+  struct chunk *c = arg;
+  struct agg_record *w;
+
+  if (c->n == c->size) {
+    c->size = c->size ? c->size * 2 : 1024;
+    if ((w = realloc (c->win, c->size * sizeof (*w))) == NULL) {
+      c->nomem = 1;
+      c->size = c->n;
+      return;
+    }
+    c->win = w;
+  }
+  c->win[c->n++] = *rec;
+}
+
+/* thread: aggregate the lines of one chunk, the last window stays open */
+static void *parse_chunk (void *arg) {
+  struct chunk *c = arg;
+  struct aggregator ag;
+  struct ms_sample smp;
+  const char *p, *nl;
+  struct hour hour = { "", 0, 0, 0 };
+  time_t t;
+  int started = 0;
+
+  for (p = c->p; p < c->end; p = nl + 1) {
+    if ((nl = memchr (p, '\n', c->end - p)) == NULL)
+      nl = c->end;
+    c->lines++;
+    if (parse_line (p, nl - p, &hour, &t, &smp) == -1) {
+      c->skipped++;                    // "gap", garbage or a cut off last line
+      continue;
+    }
+    if (!started) {
+      agg_init (&ag, c->interval, t - 1);
+      started = 1;
+    }
+    agg_add (&ag, &smp, t - 1, collect, c);
+  }
+  if (started)
+    collect (&ag.cur, c);
+  return NULL;
+}
+
+static void output (struct output *o, const struct agg_record *rec) {
+  struct binlog_rec r;
+  char datestr[TS_DATELEN + 1];
+  char values[80];
+
+  binlog_fill (&r, rec);
+  if (r.time <= o->after) {
+    o->old++;
+    return;
+  }
+  o->windows++;
+  if (o->bl.fd != -1)
+    binlog_append (&o->bl, &r);
+  if (o->rrd) {
+    binlog_rrd (values, sizeof (values), &r);
+    fprintf (o->rrd, "update %s %s\n", o->rrdfile, values);
+  }
+  if (o->text) {
+    ts_format (&o->tc, r.time, datestr);
+    binlog_values (values, sizeof (values), &r);
+    printf ("%s %s\n", datestr, values);
+  }
+}
+
+/*
+ * write the windows of the chunks in order; the first window of a chunk
+ * is merged into the last one before if it is the same, and the gaps
+ * between chunks are filled like agg_tick () would have done
+ */
+static void merge (struct output *o, struct agg_record *last, int *have, struct chunk *c, int n) {
+  struct agg_record gap;
+  const struct agg_record *w;
+  time_t end;
+  size_t j;
+  int i;
+
+  for (i = 0; i < n; i++)
+    for (j = 0; j < c[i].n; j++) {
+      w = &c[i].win[j];
+      if (*have && w->start == last->start) {
+        agg_merge (last, w);
+        continue;
+      }
+      if (*have && w->start < last->start) {
+        o->old++;                      // the clock went back while logging
+        continue;
+      }
+      if (*have) {
+        output (o, last);
+        end = last->start + last->interval;
+        if ((w->start - end) / w->interval <= AGG_MAXGAPS)
+          for (; end < w->start; end += gap.interval) {
+            memset (&gap, 0, sizeof (gap));
+            gap.start = end;
+            gap.interval = w->interval;
+            output (o, &gap);
+          }
+      }
+      *last = *w;
+      *have = 1;
+    }
+}
+
+/* start of the line after p */
+static const char *nextline (const char *p, const char *end) {
+  const char *nl = (p < end) ? memchr (p, '\n', end - p) : NULL;
+
+  return nl ? nl + 1 : end;
+}
+
+int main (int argc, char **argv) {
+  static struct chunk chunk[MAXTHREADS];
+  pthread_t tid[MAXTHREADS];
+  int running[MAXTHREADS];
+  struct output o;
+  struct binlog_map m;
+  struct agg_record last;
+  struct timespec t0, t1;
+  struct stat st;
+  const char *binlogf = NULL, *map, *p, *end;
+  unsigned long lines = 0, skipped = 0;
+  int interval = 300, threads = sysconf (_SC_NPROCESSORS_ONLN);
+  int have = 0, fd, c, i, n;
+
+  memset (&o, 0, sizeof (o));
+  o.bl.fd = o.bl.idxfd = -1;
+  while ((c = getopt (argc, argv, "i:j:b:R:")) != -1) {
+    switch (c) {
+      case 'i':
+        if ((interval = atoi (optarg)) < 10) {
+          fprintf (stderr, "interval must be at least 10 seconds\n");
+          exit (1);
+        }
+        break;
+      case 'j':
+        threads = atoi (optarg);
+        break;
+      case 'b':
+        binlogf = optarg;
+        break;
+      case 'R':
+        o.rrdfile = optarg;
+        break;
+      default:
+        usage (argv[0]);
+        exit (1);
+    } /* switch () */
+  } /* while getopt */
+
+  if (optind == argc) {
+    usage (argv[0]);
+    exit (1);
+  }
+  threads = (threads < 1) ? 1 : (threads > MAXTHREADS) ? MAXTHREADS : threads;
+  tzset ();
+
+  if (binlogf) {
+    if (binlog_map (&m, binlogf) == 0) {        // only append what is newer
+      if (m.count)
+        o.after = m.rec[m.count - 1].time;
+      binlog_unmap (&m);
+    }
+    if (binlog_open (&o.bl, binlogf) == -1) {
+      fprintf (stderr, "cannot open %s\n", binlogf);
+      exit (1);
+    }
+  }
+  if (o.rrdfile && (o.rrd = popen (RRDTOOL " - >/dev/null", "w")) == NULL) {
+    fprintf (stderr, "cannot start " RRDTOOL "\n");
+    exit (1);
+  }
+  o.text = (binlogf == NULL && o.rrdfile == NULL);
+
+  clock_gettime (CLOCK_MONOTONIC, &t0);
+  for (; optind < argc; optind++) {
+    if ((fd = open (argv[optind], O_RDONLY)) == -1 || fstat (fd, &st) == -1) {
+      fprintf (stderr, "cannot read %s\n", argv[optind]);
+      exit (1);
+    }
+    if (st.st_size == 0) {
+      close (fd);
+      continue;
+    }
+    if ((map = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+      fprintf (stderr, "cannot map %s\n", argv[optind]);
+      exit (1);
+    }
+    close (fd);
+    madvise ((void *)map, st.st_size, MADV_SEQUENTIAL);
+
+    /* one round is a chunk for every thread, so memory stays bounded */
+    for (p = map, end = map + st.st_size; p < end; ) {
+      for (n = 0; n < threads && p < end; n++) {
+        chunk[n].p = p;
+        chunk[n].end = p = (end - p > CHUNK) ? nextline (p + CHUNK, end) : end;
+        chunk[n].interval = interval;
+        chunk[n].n = 0;
+      }
+      for (i = 1; i < n; i++)
+        running[i] = (pthread_create (&tid[i], NULL, parse_chunk, &chunk[i]) == 0);
+      for (i = 0; i < n; i++)
+        if (i == 0 || !running[i])     // the main thread helps, or does it all
+          parse_chunk (&chunk[i]);
+      for (i = 1; i < n; i++)
+        if (running[i])
+          pthread_join (tid[i], NULL);
+      for (i = 0; i < n; i++) {
+        if (chunk[i].nomem) {
+          fprintf (stderr, "out of memory\n");
+          exit (1);
+        }
+        lines += chunk[i].lines;
+        skipped += chunk[i].skipped;
+        chunk[i].lines = chunk[i].skipped = 0;
+      }
+      merge (&o, &last, &have, chunk, n);
+    }
+    munmap ((void *)map, st.st_size);
+  }
+  if (have)
+    output (&o, &last);
+  clock_gettime (CLOCK_MONOTONIC, &t1);
+
+  for (i = 0; i < threads; i++)
+    free (chunk[i].win);
+  binlog_close (&o.bl);
+  if (o.rrd && pclose (o.rrd) != 0)
+    fprintf (stderr, RRDTOOL " failed\n");
+  fprintf (stderr, "%lu lines (%lu skipped), %lu intervals", lines, skipped, o.windows);
+  if (o.old)
+    fprintf (stderr, " (%lu older ones left out)", o.old);
+  fprintf (stderr, " in %.3f s\n", (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9);
+  return 0;
+}
@@ -0,0 +1,107 @@
+/*
+ * eltakoMS-watch sleeps on the binary status record of eltakoMS (-m or
+ * -M) and prints every new datagram as soon as it has been read, in the
+ * format of the text log:
+ *    2008-04-03 17:03:20 t+07.6s01w63e00od999v01.2r
+ *
+ *   eltakoMS-watch [ -c ] [ -t <sec> ] <shmfile>
+ *
+ * With -c only datagrams that differ from the previous one are printed.
+ * With -t a line "timeout" is printed if no datagram arrives for <sec>
+ * seconds. Output is line buffered, so it can be piped into a script.
+ *
+ * This software is copyright 2008 by Frank Sautter
+ * (eltakoms~at~sautter~dot~com)
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any later
+ * version.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "status.h"
+#include "timestamp.h"
+
+void usage (char *prog) {
+  printf ("usage: %s [ -c ] [ -t <sec> ] <shmfile>\n", prog);
+  printf ("\t-c\tprint changed datagrams only\n");
+  printf ("\t-t <sec>\tprint \"timeout\" after <sec> seconds without datagrams\n");
+  printf ("\t<shmfile> is the status file of eltakoMS, e.g. /dev/shm/eltakoMS-ttyS1\n");
+}
+
+int main (int argc, char **argv) {
+  struct ms_status *st, cur;
+  struct ms_sample last;
+  struct ts_cache tc = { 0 };
+  char path[200], datestr[TS_DATELEN + 1];
+  uint32_t seen, stale;
+  int changes = 0, timeout = -1;
+  int fd, c;
+
+  while ((c = getopt (argc, argv, "ct:")) != -1) {
+    switch (c) {
+      case 'c':
+        changes = 1;
+        break;
+      case 't':
+        timeout = atoi (optarg) * 1000;
+        break;
+      default:
+        usage (argv[0]);
+        exit (1);
+    } /* switch () */
+  } /* while getopt */
+
+  if (optind != argc - 1) {
+    usage (argv[0]);
+    exit (1);
+  }
+  snprintf (path, sizeof (path), "%s", argv[optind]);
+  if (strlen (path) < 4 || strcmp (path + strlen (path) - 4, ".bin"))
+    strncat (path, ".bin", sizeof (path) - strlen (path) - 1);
+  if ((fd = open (path, O_RDWR)) == -1 ||
+      (st = mmap (NULL, sizeof (*st), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+    fprintf (stderr, "cannot map %s\n", path);
+    exit (1);
+  }
+  close (fd);
+  if (st->magic != MS_STATUS_MAGIC || st->version != MS_STATUS_VERSION || st->size != sizeof (*st)) {
+    fprintf (stderr, "%s: no eltakoMS status record of version %d\n", path, MS_STATUS_VERSION);
+    exit (1);
+  }
+
+  setvbuf (stdout, NULL, _IOLBF, 0);
+  ms_status_read (st, &cur);
+  seen = cur.samples;
+  stale = cur.stale;
+  memset (&last, 0xff, sizeof (last));
+  while (1) {
+    if (ms_status_wait (st, cur.seq, timeout) == -1) {
+      printf ("timeout\n");
+      continue;
+    }
+    ms_status_read (st, &cur);
+    if (cur.stale && !stale)
+      printf ("stale\n");
+    stale = cur.stale;
+    if (cur.samples == seen)
+      continue;                                                 // interval closed or stale
+    if ((seen = cur.samples) == 0)
+      continue;                                                 // eltakoMS started anew
+    if (changes && memcmp (&cur.smp, &last, sizeof (last)) == 0)
+      continue;
+    last = cur.smp;
+    ts_format (&tc, cur.time, datestr);
+    printf ("%s t%+05.1fs%2.2dw%2.2de%2.2d%cd%3.3dv%04.1f%c\n", datestr,
+            (float)cur.smp.temp/10, cur.smp.sunS, cur.smp.sunW, cur.smp.sunE,
+            (cur.smp.flags & MS_OBSC) ? 'O' : 'o', cur.smp.dawn,
+            (float)cur.smp.wind/10, (cur.smp.flags & MS_RAIN) ? 'R' : 'r');
+  } /* while (1) */
+}